@@ -0,0 +1,283 @@
+/* telemetry_decode
+ *
+ * Host side decoder of the binary telemetry stream sent by 14_telemetry, the
+ * protocol is described in src/telemetry.h.
+ *
+ * Usage:
+ *   telemetry_decode [-c] [FILE|TTY]   decode a captured stream or a serial
+ *                                      port (stdin when omitted), -c prints
+ *                                      every sample as CSV
+ *   telemetry_decode -g N              generate a stream of N synthetic
+ *                                      samples to stdout, used to test and
+ *                                      benchmark the decoder
+ *
+ * At the end (or on Ctrl+C) it prints the number of packets and samples, CRC
+ * and framing errors, lost packets from the sequence numbers, resyncs after a
+ * reset of the firmware and the decode speed in samples per second. */
+
+#include "telemetry.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+	uint64_t packets;
+	uint64_t samples;
+	uint64_t crc_errors;
+	uint64_t frame_errors;
+	uint64_t lost_packets;
+	uint64_t bytes;
+	uint64_t resyncs;
+	int has_seq;
+	uint16_t next_seq;
+	uint32_t last_time;
+} Stats;
+
+static volatile sig_atomic_t stop = 0;
+
+static void on_signal(int sig) {
+	(void)sig;
+	stop = 1;
+}
+
+static double now_seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint16_t get16(const uint8_t *buf) { return buf[0] | (buf[1] << 8); }
+
+static uint32_t get32(const uint8_t *buf) {
+	return (uint32_t)get16(buf) | ((uint32_t)get16(buf + 2) << 16);
+}
+
+/* Decodes one COBS frame (without the 0x00 delimiter) */
+static void decode_frame(const uint8_t *frame, uint16_t frame_len, Stats *st,
+						 FILE *csv) {
+	uint8_t packet[TELEMETRY_MAX_FRAME];
+
+	int32_t len = telemetry_cobs_decode(frame, frame_len, packet);
+	if (len < TELEMETRY_HEADER_SIZE + 2 || packet[0] != TELEMETRY_TYPE_GYRO) {
+		st->frame_errors++;
+		return;
+	}
+
+	uint16_t crc = TELEMETRY_CRC_INIT;
+	for (int32_t i = 0; i < len - 2; i++) {
+		crc = telemetry_crc16(crc, packet[i]);
+	}
+	if (crc != get16(&packet[len - 2])) {
+		st->crc_errors++;
+		return;
+	}
+
+	uint16_t seq = get16(&packet[1]);
+	uint32_t time = get32(&packet[3]);
+	uint8_t count = packet[7];
+
+	const uint8_t *pos = &packet[TELEMETRY_HEADER_SIZE];
+	const uint8_t *end = &packet[len - 2];
+	int16_t last[3] = {0, 0, 0};
+	for (uint8_t i = 0; i < count; i++) {
+		uint32_t value;
+		uint8_t n = telemetry_get_varint(pos, end, &value);
+		if (n == 0) {
+			st->frame_errors++;
+			return;
+		}
+		pos += n;
+		time += value;
+		for (int axis = 0; axis < 3; axis++) {
+			n = telemetry_get_varint(pos, end, &value);
+			if (n == 0 || value > 0xFFFF) {
+				st->frame_errors++;
+				return;
+			}
+			pos += n;
+			last[axis] = (uint16_t)(last[axis] + telemetry_unzigzag(value));
+		}
+		if (csv) {
+			fprintf(csv, "%llu,%d,%d,%d\n",
+					(unsigned long long)time * TELEMETRY_TICK_US, last[0],
+					last[1], last[2]);
+		}
+	}
+
+	/* A sequence number that jumps backwards (more than half of the 16-bit
+	 * range ahead) or a timestamp that goes back in time means the firmware
+	 * was reset, the counting starts again instead of adding ~65535 lost
+	 * packets */
+	uint32_t packet_time = get32(&packet[3]);
+	if (st->has_seq) {
+		uint16_t gap = seq - st->next_seq;
+		if (gap >= 0x8000 || (int32_t)(packet_time - st->last_time) < 0) {
+			st->resyncs++;
+		} else {
+			st->lost_packets += gap;
+		}
+	}
+	st->has_seq = 1;
+	st->next_seq = seq + 1;
+	st->last_time = packet_time;
+	st->packets++;
+	st->samples += count;
+}
+
+static int decode(int fd, FILE *csv) {
+	static uint8_t buf[1 << 16];
+	uint8_t frame[TELEMETRY_MAX_FRAME];
+	uint16_t frame_len = 0;
+	int overflow = 0;
+	Stats st = {0};
+
+	double start = now_seconds();
+	while (!stop) {
+		ssize_t n = read(fd, buf, sizeof(buf));
+		if (n == 0) {
+			break;
+		}
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("read");
+			break;
+		}
+		st.bytes += n;
+
+		for (ssize_t i = 0; i < n; i++) {
+			if (buf[i] == 0x00) {
+				if (overflow) {
+					st.frame_errors++;
+				} else if (frame_len) {
+					decode_frame(frame, frame_len, &st, csv);
+				}
+				frame_len = 0;
+				overflow = 0;
+			} else if (frame_len < sizeof(frame)) {
+				frame[frame_len++] = buf[i];
+			} else {
+				// Too long for a valid frame, drop until the next delimiter
+				overflow = 1;
+			}
+		}
+	}
+	double elapsed = now_seconds() - start;
+
+	double lost_ratio = 0;
+	if (st.packets + st.lost_packets) {
+		lost_ratio = (double)st.lost_packets / (st.packets + st.lost_packets);
+	}
+	fprintf(stderr,
+			"bytes: %llu\n"
+			"packets: %llu\n"
+			"samples: %llu\n"
+			"crc errors: %llu\n"
+			"frame errors: %llu\n"
+			"lost packets: %llu (%.3f%%)\n"
+			"resyncs: %llu\n"
+			"bytes/sample: %.2f\n"
+			"decode rate: %.0f samples/s\n",
+			(unsigned long long)st.bytes, (unsigned long long)st.packets,
+			(unsigned long long)st.samples, (unsigned long long)st.crc_errors,
+			(unsigned long long)st.frame_errors,
+			(unsigned long long)st.lost_packets, lost_ratio * 100,
+			(unsigned long long)st.resyncs,
+			st.samples ? (double)st.bytes / st.samples : 0,
+			elapsed > 0 ? st.samples / elapsed : 0);
+	return 0;
+}
+
+/* Synthetic gyro, a random walk sampled every ~250us like the MPU6050 read
+ * loop of 14_telemetry, encoded exactly like the firmware does */
+static int generate(uint64_t samples) {
+	TelemetryPacket packet;
+	uint8_t frame[TELEMETRY_MAX_FRAME + 1];
+	int16_t gyro[3] = {0, 0, 0};
+	uint32_t time = 0;
+	uint16_t seq = 0;
+
+	srand(1);
+	while (samples) {
+		uint8_t count = samples < TELEMETRY_SAMPLES_PER_PACKET
+							? samples
+							: TELEMETRY_SAMPLES_PER_PACKET;
+		for (uint8_t i = 0; i < count; i++) {
+			if (i == 0) {
+				telemetry_packet_start(&packet, seq, time);
+			} else {
+				time += 60 + rand() % 8;
+			}
+			for (int axis = 0; axis < 3; axis++) {
+				gyro[axis] += rand() % 33 - 16;
+			}
+			telemetry_packet_add(&packet, time, gyro);
+		}
+		// The next packet starts one sample period later
+		time += 64;
+
+		uint16_t frame_len = telemetry_packet_finish(&packet, frame);
+		frame[frame_len++] = 0x00;
+		if (fwrite(frame, 1, frame_len, stdout) != frame_len) {
+			perror("write");
+			return 1;
+		}
+
+		samples -= count;
+		seq++;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	int opt;
+	FILE *csv = NULL;
+	while ((opt = getopt(argc, argv, "cg:")) != -1) {
+		switch (opt) {
+		case 'c':
+			csv = stdout;
+			break;
+		case 'g':
+			return generate(strtoull(optarg, NULL, 10));
+		default:
+			fprintf(stderr, "usage: %s [-c] [FILE|TTY] | -g SAMPLES\n",
+					argv[0]);
+			return 1;
+		}
+	}
+
+	int fd = STDIN_FILENO;
+	if (optind < argc) {
+		fd = open(argv[optind], O_RDONLY | O_NOCTTY);
+		if (fd < 0) {
+			perror(argv[optind]);
+			return 1;
+		}
+	}
+
+	/* A serial port (or the simavr pty) must be in raw mode, otherwise the
+	 * terminal driver would change or hold back bytes of the binary stream.
+	 * The baud rate is left as is, set it with stty when using the board */
+	if (isatty(fd)) {
+		struct termios tio;
+		if (tcgetattr(fd, &tio) == 0) {
+			cfmakeraw(&tio);
+			tcsetattr(fd, TCSANOW, &tio);
+		}
+	}
+
+	/* Without SA_RESTART the blocking read returns on Ctrl+C so the
+	 * statistics can be printed */
+	struct sigaction sa = {0};
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	return decode(fd, csv);
+}
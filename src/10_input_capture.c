@@ -0,0 +1,381 @@
+/* 10_input_capture */
+
+#include "avr_atmega328p.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+// #define BAUD 9600
+#define UBRR 103 // ((CPU_CLOCK / 16 / BAUD) - 1)
+
+void USART_init() {
+	// Setting UBRR value so the BAUD rate is correct
+	GET_ADDR(UBRR0L) = UBRR;
+	GET_ADDR(UBRR0H) = UBRR >> 8;
+
+	// Configure the transmissing data size as 8-bit
+	SET_BIT(UCSR0C, 1);
+	SET_BIT(UCSR0C, 2);
+
+	// Enable the USART transmitter
+	SET_BIT(UCSR0B, 3);
+}
+
+void USART_write_byte(uint8_t byte) {
+	while (!READ_BIT(UCSR0A, 5)) {
+		// wait UDREn be HIGH to indicate transmitter register to be empty
+	}
+
+	// write data
+	GET_ADDR(UDR0) = byte;
+}
+
+void USART_print(char *str) {
+	// iterate over the string and transmit byte by byte
+	while (*str) {
+		USART_write_byte(*str++);
+	}
+}
+
+/* Same as USART_print but the string lives in the flash, more on that at
+ * "avr_atmega328p.h" */
+void USART_print_P(const char *str) {
+	uint8_t byte;
+	while ((byte = PGM_READ_BYTE(str++))) {
+		USART_write_byte(byte);
+	}
+}
+
+void USART_println_P(const char *str) {
+	USART_print_P(str);
+	USART_write_byte('\r');
+	USART_write_byte('\n');
+}
+
+// Input capture starts here
+
+/* Polling a pin like in 2_button_polling only sees an edge when the loop
+ * happens to read the pin, the time between the edge and the read is lost.
+ * The input capture unit of Timer1 solves this in hardware, when an edge
+ * arrives at the ICP1 (PB0) pin the current TCNT1 value is copied to the ICR1
+ * register at that exact CPU cycle, the interrupt routine can take its time to
+ * read it without adding any jitter to the timestamp.
+ *
+ * Timer1 runs without prescaler so each tick is a single CPU cycle (62.5ns),
+ * the 16-bit timer overflows every 4.096ms so the overflows are counted by
+ * software to extend the timestamps to 32-bit (about 268 seconds).
+ *
+ * Each capture costs one run of the interrupt routine, the highest frequency
+ * that can be measured is set by how long it takes, in the both edges mode the
+ * routine must also finish within the high and low time of the signal. When it
+ * doesn't an edge is lost, the routine detects it and the main program
+ * discards the measurement instead of printing a wrong one.
+ *
+ * Counting the instructions (not measured), the routine takes around 130
+ * cycles with entering and leaving it, limiting the interrupt driven capture
+ * to about 100kHz with rising edges only and about 50kHz with both edges at a
+ * 50% duty cycle. For faster signals capture_burst polls the ICF1 flag with
+ * the interrupts disabled, around 20 cycles per edge, reaching about 800kHz
+ * with rising edges only and about 300kHz with both edges at 50% duty */
+
+/* The captures are stored in a ring, the interrupt routine keeps writing over
+ * the oldest entries and never stops. capture_head is the free running index
+ * of the next write, it is 8-bit so reading it is always atomic */
+#define CAPTURE_SIZE 32 // power of two so the index wraps with a mask
+#define CAPTURE_WINDOW 16 // captures used by each measurement
+
+typedef struct {
+	uint32_t time;
+	uint8_t rising;
+} Capture;
+
+volatile Capture captures[CAPTURE_SIZE];
+volatile uint8_t capture_head = 0;
+volatile uint16_t timer1_overflows = 0;
+uint8_t capture_both_edges = 0;
+
+ISR(TIMER1_OVF_VEC) { timer1_overflows++; }
+
+ISR(TIMER1_CAPT_VEC) {
+	// Low byte must be read first, it latches the high byte
+	uint8_t icr_low = GET_ADDR(ICR1L);
+	uint16_t icr = ((uint16_t)GET_ADDR(ICR1H) << 8) | icr_low;
+
+	/* The capture interrupt has priority over the overflow interrupt, if the
+	 * timer overflowed just before the edge the TOV1 flag is still pending
+	 * and timer1_overflows is one behind. A small ICR1 value means the capture
+	 * happened after that overflow, so we account for it here */
+	uint16_t overflows = timer1_overflows;
+	if (READ_BIT(TIFR1, 0) && icr < 0x8000) {
+		overflows++;
+	}
+
+	uint8_t head = capture_head;
+	uint8_t rising = READ_BIT(TCCR1B, 6);
+	captures[head & (CAPTURE_SIZE - 1)].time =
+		((uint32_t)overflows << 16) | icr;
+	captures[head & (CAPTURE_SIZE - 1)].rising = rising;
+	capture_head = head + 1;
+
+	if (capture_both_edges) {
+		/* Flip the ICES1 flag so the next capture happens on the opposite
+		 * edge, changing the edge may set ICF1 so it must be cleared. TIFR1
+		 * flags are cleared by writing 1 to them, so we write only the ICF1
+		 * bit instead of using SET_BIT, otherwise a pending TOV1 would be
+		 * cleared too and an overflow lost */
+		TOGGLE_BIT(TCCR1B, 6);
+		GET_ADDR(TIFR1) = (1 << 5);
+
+		/* If the opposite edge already happened while this routine ran, the
+		 * pin is at its new level and no capture is pending, the edge is lost.
+		 * Waiting for it would record the next one, a whole period late, as a
+		 * valid looking capture. Instead we keep waiting for the same edge
+		 * type, so the next capture breaks the rising/falling alternation and
+		 * capture_measure knows the window is bad */
+		uint8_t pin = READ_BIT(PINB, 0) ? 1 : 0;
+		uint8_t edge_lost = rising ? !pin : pin;
+		if (edge_lost && !READ_BIT(TIFR1, 5)) {
+			TOGGLE_BIT(TCCR1B, 6);
+			GET_ADDR(TIFR1) = (1 << 5);
+		}
+	}
+}
+
+/* noise_canceler: setting ICNC1 makes the capture unit only accept an edge
+ * after 4 equal samples of the pin, it delays every timestamp by 4 cycles so
+ * the measured period is not affected.
+ * both_edges: capture rising and falling edges, needed for the duty cycle */
+void capture_init(uint8_t noise_canceler, uint8_t both_edges) {
+	capture_both_edges = both_edges;
+
+	// ICP1 (PB0) as INPUT
+	UNSET_BIT(DDRB, 0);
+
+	// Timer1 in normal mode, counting from 0 to 0xFFFF
+	GET_ADDR(TCCR1A) = 0;
+	/* ICNC1 (bit 7) enables the noise canceler, ICES1 (bit 6) captures on
+	 * rising edge and CS10 (bit 0) clocks the timer without prescaler */
+	GET_ADDR(TCCR1B) = ((noise_canceler ? 1 : 0) << 7) | (1 << 6) | (1 << 0);
+
+	// TOIE1 enables the overflow interrupt used to extend the timestamps
+	SET_BIT(TIMSK1, 0);
+	// Clear any old capture and enable the capture interrupt (ICIE1)
+	GET_ADDR(TIFR1) = (1 << 5);
+	SET_BIT(TIMSK1, 5);
+}
+
+uint16_t timer1_overflows_read() {
+	/* A 16-bit variable is read with 2 instructions, disable the interrupts so
+	 * the overflow routine can't change it in between */
+	uint16_t overflows;
+	ATOMIC_BLOCK { overflows = timer1_overflows; }
+	return overflows;
+}
+
+/* Copies the last CAPTURE_WINDOW captures, oldest first. The copy is done
+ * with the interrupts enabled so no edge is delayed, if the routine wrote over
+ * an entry while it was being copied the copy is done again. Returns 0 if
+ * less than CAPTURE_WINDOW new captures arrived in about 1 second (244
+ * overflows of 4.096ms) */
+uint8_t capture_read(uint8_t since, Capture window[CAPTURE_WINDOW]) {
+	uint16_t start = timer1_overflows_read();
+	while ((uint8_t)(capture_head - since) < CAPTURE_WINDOW) {
+		if ((uint16_t)(timer1_overflows_read() - start) > 244) {
+			return 0;
+		}
+	}
+
+	while (1) {
+		uint8_t head = capture_head;
+		for (uint8_t i = 0; i < CAPTURE_WINDOW; i++) {
+			uint8_t index = (head - CAPTURE_WINDOW + i) & (CAPTURE_SIZE - 1);
+			window[i].time = captures[index].time;
+			window[i].rising = captures[index].rising;
+		}
+		/* The oldest entry copied is only overwritten after
+		 * CAPTURE_SIZE - CAPTURE_WINDOW more captures */
+		if ((uint8_t)(capture_head - head) <= CAPTURE_SIZE - CAPTURE_WINDOW) {
+			return 1;
+		}
+	}
+}
+
+typedef struct {
+	uint32_t period;    // average period in CPU cycles
+	uint32_t frequency; // Hz
+	uint16_t duty;      // duty cycle in 0.1%, only with both edges
+} Measurement;
+
+/* Instead of using only the last 2 captures, averaging over the whole window
+ * (first to last rising edge) gives us more precision than a single cycle.
+ *
+ * With both edges the captures must alternate between rising and falling, a
+ * lost edge shows up as 2 captures of the same type. Only the captures after
+ * the last break are used, so the measurement resyncs on its own, returns 0 if
+ * not a single full cycle is left */
+uint8_t capture_measure(Capture window[CAPTURE_WINDOW], Measurement *m) {
+	uint8_t first = 0;
+	if (capture_both_edges) {
+		for (uint8_t i = 1; i < CAPTURE_WINDOW; i++) {
+			if (window[i].rising == window[i - 1].rising) {
+				first = i;
+			}
+		}
+	}
+	// Measure from rising edge to rising edge
+	while (first < CAPTURE_WINDOW && !window[first].rising) {
+		first++;
+	}
+	if (first >= CAPTURE_WINDOW) {
+		return 0;
+	}
+	uint8_t last = CAPTURE_WINDOW - 1;
+	while (last > first && !window[last].rising) {
+		last--;
+	}
+
+	uint8_t step = capture_both_edges ? 2 : 1;
+	uint8_t cycles = (last - first) / step;
+	if (cycles == 0) {
+		return 0;
+	}
+
+	uint32_t span = window[last].time - window[first].time;
+	m->period = span / cycles;
+	// f = CPU_CLOCK / (span / cycles)
+	m->frequency = ((uint32_t)CPU_CLOCK * cycles) / span;
+	m->duty = 0;
+
+	if (capture_both_edges) {
+		uint32_t high = 0;
+		for (uint8_t i = first; i < last; i += 2) {
+			high += window[i + 1].time - window[i].time;
+		}
+		// scale down so high * 1000 can't overflow 32-bit
+		while (span > 0x3FFFFF) {
+			span >>= 1;
+			high >>= 1;
+		}
+		m->duty = (high * 1000) / span;
+	}
+
+	return 1;
+}
+
+/* High rate path, BURST_SIZE edges are captured in a tight loop polling the
+ * ICF1 flag with the interrupts disabled, no time is spent saving registers
+ * or building 32-bit timestamps. The burst lasts only a few thousand cycles,
+ * so 16-bit timestamps are enough for signals above ~4kHz, used when the
+ * interrupt driven capture is too slow */
+#define BURST_SIZE 16
+#define BURST_THRESHOLD 20000 // Hz
+
+uint8_t capture_burst(Measurement *m) {
+	uint16_t times[BURST_SIZE];
+	uint8_t ok = 1;
+	uint8_t tccr1b = GET_ADDR(TCCR1B);
+
+	ATOMIC_BLOCK {
+		// Always start at a rising edge
+		SET_BIT(TCCR1B, 6);
+		GET_ADDR(TIFR1) = (1 << 5);
+		for (uint8_t i = 0; i < BURST_SIZE && ok; i++) {
+			// ~25ms without an edge means the signal is gone
+			uint16_t timeout = 0xFFFF;
+			while (!READ_BIT(TIFR1, 5)) {
+				if (--timeout == 0) {
+					ok = 0;
+					break;
+				}
+			}
+			// Low byte must be read first, it latches the high byte
+			uint8_t icr_low = GET_ADDR(ICR1L);
+			times[i] = ((uint16_t)GET_ADDR(ICR1H) << 8) | icr_low;
+			if (capture_both_edges) {
+				TOGGLE_BIT(TCCR1B, 6);
+			}
+			GET_ADDR(TIFR1) = (1 << 5);
+		}
+
+		/* Give the edge selection back to the interrupt driven capture, the
+		 * edges of the burst are missing from its ring but capture_read only
+		 * uses captures newer than the call */
+		GET_ADDR(TCCR1B) = tccr1b;
+		GET_ADDR(TIFR1) = (1 << 5);
+	}
+	if (!ok) {
+		return 0;
+	}
+
+	uint8_t step = capture_both_edges ? 2 : 1;
+	// Index of the last rising edge, the burst starts at a rising edge
+	uint8_t last = BURST_SIZE - step;
+	uint8_t cycles = last / step;
+
+	uint16_t span = times[last] - times[0];
+	m->period = span / cycles;
+	m->frequency = ((uint32_t)CPU_CLOCK * cycles) / span;
+	m->duty = 0;
+
+	if (capture_both_edges) {
+		uint32_t high = 0;
+		for (uint8_t i = 0; i < last; i += 2) {
+			high += (uint16_t)(times[i + 1] - times[i]);
+		}
+		m->duty = (high * 1000) / span;
+	}
+
+	return 1;
+}
+
+int main(void) {
+	USART_init();
+	USART_println_P(PSTR("Hello from ATmega328P"));
+
+	/* Test signal, connect OC0A (PD6) to ICP1 (PB0). Timer0 in fast PWM mode
+	 * (WGM00, WGM01, COM0A1) with a prescaler of 8 (CS01) gives us
+	 * 16Mhz / 8 / 256 = 7812Hz with a duty cycle of (63 + 1) / 256 = 25% */
+	SET_BIT(DDRD, 6);
+	GET_ADDR(OCR0A) = 63;
+	GET_ADDR(TCCR0A) = (1 << 7) | (1 << 1) | (1 << 0);
+	GET_ADDR(TCCR0B) = (1 << 1);
+
+	capture_init(1, 1);
+	SET_BIT(SREG, 7);
+
+	Capture window[CAPTURE_WINDOW];
+	Measurement m;
+	char buff[16];
+	while (1) {
+		// Wait for a full window of captures newer than the last measurement
+		if (!capture_read(capture_head, window)) {
+			USART_println_P(PSTR("no signal"));
+			continue;
+		}
+		/* Lost edges or a fast signal, measure again with the burst, its
+		 * timestamps are precise but only 16-bit */
+		uint8_t burst = 0;
+		if (!capture_measure(window, &m) || m.frequency > BURST_THRESHOLD) {
+			burst = 1;
+			if (!capture_burst(&m)) {
+				USART_println_P(PSTR("edges lost, signal too fast"));
+				continue;
+			}
+		}
+
+		USART_print_P(PSTR("period: "));
+		ultoa(m.period, buff, 10);
+		USART_print(buff);
+		USART_print_P(PSTR(" cycles, freq: "));
+		ultoa(m.frequency, buff, 10);
+		USART_print(buff);
+		USART_print_P(PSTR(" Hz, duty: "));
+		utoa(m.duty / 10, buff, 10);
+		USART_print(buff);
+		USART_write_byte('.');
+		utoa(m.duty % 10, buff, 10);
+		USART_print(buff);
+		USART_println_P(burst ? PSTR("% (burst)") : PSTR("%"));
+	}
+
+	return 0;
+}
@@ -0,0 +1,123 @@
+/* 11_timer1_pwm */
+
+#include "avr_atmega328p.h"
+#include <stdint.h>
+
+/* In 6_adc the 10-bit ADC value had to be shifted down to 8 bits because the
+ * 8-bit Timer0 can only count up to 255. Timer1 is a 16-bit timer and in the
+ * PWM modes 10 and 14 the TOP value (where the timer restarts or turns back) is
+ * taken from the ICR1 register, this lets us choose the PWM resolution
+ * ourselves, trading it against the PWM frequency:
+ *
+ * fast PWM:          f = CPU_CLOCK / (prescaler * (1 + TOP))
+ * phase correct PWM: f = CPU_CLOCK / (2 * prescaler * TOP)
+ *
+ * Without prescaler (fast PWM):
+ *  8-bit,  TOP = 255   -> 62.5kHz
+ * 10-bit,  TOP = 1023  -> 15.6kHz
+ * 12-bit,  TOP = 4095  -> 3.9kHz
+ * 16-bit,  TOP = 65535 -> 244Hz
+ *
+ * Phase correct PWM has half of the frequency but since the timer counts up
+ * and down the pulses stay centered in the period, this is preferred when
+ * driving motors */
+
+#define PWM16_FAST 0
+#define PWM16_PHASE_CORRECT 1
+
+/* 10-bit resolution, same as the ADC so the reading maps directly to a duty
+ * cycle */
+#define PWM_TOP 1023
+
+void PWM16_init(uint8_t mode, uint16_t top) {
+	// OC1A (PB1) and OC1B (PB2) as OUTPUT
+	SET_BIT(DDRB, 1);
+	SET_BIT(DDRB, 2);
+
+	/* COM1A1 and COM1B1 configure both outputs in non-inverting mode, clear on
+	 * compare match and set at BOTTOM, the WGM11 flag is shared by mode 10 and
+	 * mode 14 */
+	GET_ADDR(TCCR1A) = (1 << 7) | (1 << 5) | (1 << 1);
+
+	/* WGM13 selects mode 10 (phase correct, TOP = ICR1), adding WGM12 selects
+	 * mode 14 (fast PWM, TOP = ICR1). The mode is set first with no clock
+	 * select bits, the timer stays stopped, because ICR1 can only be written
+	 * once a mode that uses it as TOP is selected, in any other mode the write
+	 * is ignored and TOP would stay 0 */
+	uint8_t tccr1b = (1 << 4);
+	if (mode == PWM16_FAST) {
+		tccr1b |= (1 << 3);
+	}
+	GET_ADDR(TCCR1B) = tccr1b;
+
+	WRITE_REG16(ICR1L, top);
+	WRITE_REG16(OCR1AL, 0);
+	WRITE_REG16(OCR1BL, 0);
+
+	// CS10 starts the timer without prescaler
+	SET_BIT(TCCR1B, 0);
+}
+
+/* In PWM modes OCR1A/B are double buffered, the new duty cycle only takes
+ * effect at TOP (fast) or BOTTOM (phase correct), so there is no glitch in the
+ * output when it changes in the middle of a period. The write still needs to
+ * be atomic because the ADC interrupt routine and the main program both write
+ * 16-bit registers through the shared TEMP register */
+void PWM16_set_a(uint16_t duty) { WRITE_REG16(OCR1AL, duty); }
+void PWM16_set_b(uint16_t duty) { WRITE_REG16(OCR1BL, duty); }
+
+ISR(ADC_VEC) {
+	// Read ADCL first then ADCH
+	uint8_t adc_low = GET_ADDR(ADCL);
+	uint16_t adc_read = ((uint16_t)GET_ADDR(ADCH) << 8) | adc_low;
+
+	/* With a 10-bit TOP the 0..1023 reading is already a valid duty cycle,
+	 * for other TOP values the reading is scaled to 0..TOP */
+	if (PWM_TOP == 1023) {
+		PWM16_set_a(adc_read);
+	} else {
+		PWM16_set_a(((uint32_t)adc_read * (PWM_TOP + 1UL)) >> 10);
+	}
+}
+
+void ADC_init() {
+	// AVcc as reference (REFS0), reading ADC0 (PC0)
+	SET_BIT(ADMUX, 6);
+
+	// ADPS0, ADPS1 and ADPS2, prescaler of 128 giving 125Khz conversion clock
+	SET_BIT(ADCSRA, 0);
+	SET_BIT(ADCSRA, 1);
+	SET_BIT(ADCSRA, 2);
+
+	// Free running (ADATE) with the conversion complete interrupt (ADIE)
+	SET_BIT(ADCSRA, 5);
+	SET_BIT(ADCSRA, 3);
+
+	// Enable the ADC (ADEN) and start the first conversion (ADSC)
+	SET_BIT(ADCSRA, 7);
+	SET_BIT(ADCSRA, 6);
+}
+
+int main(void) {
+	PWM16_init(PWM16_FAST, PWM_TOP);
+	ADC_init();
+	SET_BIT(SREG, 7);
+
+	/* While the potentiometer controls the LED on OC1A, the LED on OC1B fades
+	 * in and out going through all the 1024 steps */
+	uint16_t duty = 0;
+	int8_t step = 1;
+	while (1) {
+		PWM16_set_b(duty);
+		duty += step;
+		if (duty == 0 || duty == PWM_TOP) {
+			step *= -1;
+		}
+
+		// Fake delay so the fade takes about 1 second
+		for (volatile uint16_t i = 800; i > 0; i--) {
+		}
+	}
+
+	return 0;
+}
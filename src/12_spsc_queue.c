@@ -0,0 +1,206 @@
+/* 12_spsc_queue */
+
+#include "avr_atmega328p.h"
+#include "spsc_queue.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+// #define BAUD 9600
+#define UBRR 103 // ((CPU_CLOCK / 16 / BAUD) - 1)
+
+void USART_init() {
+	// Setting UBRR value so the BAUD rate is correct
+	GET_ADDR(UBRR0L) = UBRR;
+	GET_ADDR(UBRR0H) = UBRR >> 8;
+
+	// Configure the transmissing data size as 8-bit
+	SET_BIT(UCSR0C, 1);
+	SET_BIT(UCSR0C, 2);
+
+	// Enable the USART transmitter
+	SET_BIT(UCSR0B, 3);
+}
+
+void USART_write_byte(uint8_t byte) {
+	while (!READ_BIT(UCSR0A, 5)) {
+		// wait UDREn be HIGH to indicate transmitter register to be empty
+	}
+
+	// write data
+	GET_ADDR(UDR0) = byte;
+}
+
+void USART_print(char *str) {
+	// iterate over the string and transmit byte by byte
+	while (*str) {
+		USART_write_byte(*str++);
+	}
+}
+
+void USART_println(char *str) {
+	USART_print(str);
+	USART_write_byte('\r');
+	USART_write_byte('\n');
+}
+
+/* Same as USART_print but the string lives in the flash, more on that at
+ * "avr_atmega328p.h" */
+void USART_print_P(const char *str) {
+	uint8_t byte;
+	while ((byte = PGM_READ_BYTE(str++))) {
+		USART_write_byte(byte);
+	}
+}
+
+void USART_println_P(const char *str) {
+	USART_print_P(str);
+	USART_write_byte('\r');
+	USART_write_byte('\n');
+}
+
+// label is a flash string
+void USART_print_uint(const char *label, uint32_t value) {
+	char buff[16];
+	USART_print_P(label);
+	ultoa(value, buff, 10);
+	USART_println(buff);
+}
+
+/* Two queues, one in each direction, small on purpose so they get full often
+ * and every interleaving of the interrupt routine with the main program gets
+ * exercised */
+SPSC_QUEUE_DEFINE(seq_queue, uint16_t, 16)
+
+seq_queue_t isr_to_main;
+seq_queue_t main_to_isr;
+
+/* Sequence numbers, each side checks that it receives every value in order,
+ * any lost, repeated or corrupted item is counted as an error */
+uint16_t isr_seq = 0;
+uint16_t isr_expected = 0;
+volatile uint16_t isr_errors = 0;
+volatile uint16_t isr_full = 0;
+
+/* Producer of isr_to_main and consumer of main_to_isr, runs every ~100us with
+ * a varying period so it lands on different instructions of the main loop */
+ISR(TIMER0_COMPA_VEC) {
+	if (seq_queue_push(&isr_to_main, isr_seq)) {
+		isr_seq++;
+	} else {
+		isr_full++;
+	}
+
+	uint16_t value;
+	if (seq_queue_pop(&main_to_isr, &value)) {
+		if (value != isr_expected) {
+			isr_errors++;
+		}
+		isr_expected = value + 1;
+	}
+
+	GET_ADDR(OCR0A) = 150 + (isr_seq & 0x3F);
+}
+
+// Benchmark starts here
+
+#define BENCH_ROUNDS 8
+
+seq_queue_t bench_queue;
+
+/* Timer1 without prescaler counts CPU cycles, the queue used here is not
+ * shared with any interrupt so the measurement is done with the interrupts
+ * disabled. Each round fills the empty queue and then empties it, the loop
+ * overhead is included in the result */
+void benchmark() {
+	uint16_t push_cycles = 0;
+	uint16_t pop_cycles = 0;
+	uint16_t sum = 0;
+
+	GET_ADDR(TCCR1A) = 0;
+	GET_ADDR(TCCR1B) = (1 << 0);
+
+	ATOMIC_BLOCK {
+		for (uint8_t round = 0; round < BENCH_ROUNDS; round++) {
+			uint16_t start = READ_REG16(TCNT1L);
+			for (uint8_t i = 0; i < 16; i++) {
+				seq_queue_push(&bench_queue, i);
+			}
+			uint16_t end = READ_REG16(TCNT1L);
+			push_cycles += end - start;
+
+			uint16_t value;
+			start = READ_REG16(TCNT1L);
+			for (uint8_t i = 0; i < 16; i++) {
+				seq_queue_pop(&bench_queue, &value);
+				// Using the value so the compiler can't remove the read
+				sum += value;
+			}
+			end = READ_REG16(TCNT1L);
+			pop_cycles += end - start;
+		}
+	}
+
+	GET_ADDR(TCCR1B) = 0;
+
+	USART_print_uint(PSTR("push (cycles): "),
+					 push_cycles / (BENCH_ROUNDS * 16));
+	USART_print_uint(PSTR("pop (cycles): "), pop_cycles / (BENCH_ROUNDS * 16));
+	// Each round pops 0 + 1 + ... + 15 = 120
+	if (sum != BENCH_ROUNDS * 120) {
+		USART_println_P(PSTR("Error: benchmark queue"));
+	}
+}
+
+int main(void) {
+	USART_init();
+	USART_println_P(PSTR("Hello from ATmega328P"));
+
+	benchmark();
+
+	/* Timer0 in CTC mode (WGM01) with a prescaler of 8 (CS01), the OCR0A
+	 * compare interrupt (OCIE0A) drives the interrupt side of the test */
+	GET_ADDR(TCCR0A) = (1 << 1);
+	GET_ADDR(OCR0A) = 150;
+	GET_ADDR(TCCR0B) = (1 << 1);
+	SET_BIT(TIMSK0, 1);
+	SET_BIT(SREG, 7);
+
+	uint16_t main_seq = 0;
+	uint16_t main_expected = 0;
+	uint16_t main_errors = 0;
+	uint32_t checked = 0;
+	uint32_t next_report = 0x8000;
+
+	while (1) {
+		uint16_t value;
+		if (seq_queue_pop(&isr_to_main, &value)) {
+			if (value != main_expected) {
+				main_errors++;
+			}
+			main_expected = value + 1;
+			checked++;
+		}
+
+		if (seq_queue_push(&main_to_isr, main_seq)) {
+			main_seq++;
+		}
+
+		/* Printing blocks the main program for some milliseconds, the queue
+		 * gets full during this time and the interrupt starts counting
+		 * isr_full, this is expected and is not an error */
+		if (checked == next_report) {
+			next_report += 0x8000;
+			uint16_t errors, full;
+			ATOMIC_BLOCK {
+				errors = isr_errors;
+				full = isr_full;
+			}
+			USART_print_uint(PSTR("checked: "), checked);
+			USART_print_uint(PSTR("main errors: "), main_errors);
+			USART_print_uint(PSTR("isr errors: "), errors);
+			USART_print_uint(PSTR("isr full: "), full);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,277 @@
+/* 13_profiling */
+
+#include "avr_atmega328p.h"
+#include "spsc_queue.h"
+#include <stdint.h>
+
+/* How busy is the CPU? In 5_pwm the TIMER0_OVF_VEC runs 62500 times per
+ * second and in 8_i2c the main loop spends most of its time waiting for the
+ * TWINT flag, but from the outside both look the same, the LED fades and the
+ * values are printed. This example measures it, every second a small binary
+ * status frame is sent via USART with:
+ *
+ * - idle cycles, time the CPU spent sleeping with nothing to do
+ * - total cycles of the window, so the load is 1 - idle / total
+ * - how many times the main loop ran and its minimum/maximum duration
+ * - how many times each interrupt routine ran
+ *
+ * The time base is Timer1 running without prescaler, each tick is one CPU
+ * cycle and the overflows are counted to extend it to 32-bit */
+
+// USART with interrupt driven transmission
+
+/* Sending a byte at 9600 baud takes about 1ms, a blocking transmission would
+ * show up in the profile as busy time. Instead the bytes are pushed into a
+ * queue and the USART_UDRE_VEC routine sends them in the background */
+
+// #define BAUD 9600
+#define UBRR 103 // ((CPU_CLOCK / 16 / BAUD) - 1)
+
+SPSC_QUEUE_DEFINE(byte_queue, uint8_t, 64)
+
+byte_queue_t usart_tx_queue;
+
+void USART_init() {
+	// Setting UBRR value so the BAUD rate is correct
+	GET_ADDR(UBRR0L) = UBRR;
+	GET_ADDR(UBRR0H) = UBRR >> 8;
+
+	// Configure the transmissing data size as 8-bit
+	SET_BIT(UCSR0C, 1);
+	SET_BIT(UCSR0C, 2);
+
+	// Enable the USART transmitter
+	SET_BIT(UCSR0B, 3);
+}
+
+void USART_write_byte(uint8_t byte) {
+	while (!byte_queue_push(&usart_tx_queue, byte)) {
+		// wait for the interrupt routine to free a slot
+	}
+	/* UDRIE0 enables the data register empty interrupt, it triggers as long
+	 * as UDR0 is ready to receive a new byte */
+	SET_BIT(UCSR0B, 5);
+}
+
+// Profiling starts here
+
+#define PROFILE_WINDOW_CYCLES CPU_CLOCK // 1 second windows
+
+// Each interrupt routine has its own invocation counter
+#define PROFILE_ISR_TIMER0_OVF 0
+#define PROFILE_ISR_TIMER1_OVF 1
+#define PROFILE_ISR_USART_UDRE 2
+#define PROFILE_ISR_COUNT 3
+
+volatile uint16_t profile_isr_counts[PROFILE_ISR_COUNT];
+volatile uint16_t timer1_overflows = 0;
+
+/* While the main program sleeps, the first interrupt routine that runs (the
+ * one that woke the CPU up) saves TCNT1, this way the idle time doesn't
+ * include the time spent in that routine */
+volatile uint8_t profile_sleeping = 0;
+volatile uint16_t profile_wake_tcnt;
+
+/* Must be the first line of every interrupt routine, it costs a few cycles
+ * per invocation */
+#define PROFILE_ISR(id)                                                        \
+	do {                                                                       \
+		profile_isr_counts[id]++;                                              \
+		if (profile_sleeping) {                                                \
+			profile_wake_tcnt = READ_REG16(TCNT1L);                            \
+			profile_sleeping = 0;                                              \
+		}                                                                      \
+	} while (0)
+
+ISR(TIMER1_OVF_VEC) {
+	PROFILE_ISR(PROFILE_ISR_TIMER1_OVF);
+	timer1_overflows++;
+}
+
+ISR(USART_UDRE_VEC) {
+	PROFILE_ISR(PROFILE_ISR_USART_UDRE);
+	uint8_t byte;
+	if (byte_queue_pop(&usart_tx_queue, &byte)) {
+		GET_ADDR(UDR0) = byte;
+	} else {
+		// Nothing left to send, disable the interrupt (UDRIE0)
+		UNSET_BIT(UCSR0B, 5);
+	}
+}
+
+void profile_init() {
+	// Timer1 in normal mode without prescaler (CS10)
+	GET_ADDR(TCCR1A) = 0;
+	GET_ADDR(TCCR1B) = (1 << 0);
+	// TOIE1 enables the overflow interrupt
+	SET_BIT(TIMSK1, 0);
+
+	/* The SE flag of SMCR allows the SLEEP instruction to put the CPU to
+	 * sleep, leaving the SM flags as 0 selects the idle mode where the timers
+	 * and the USART keep running and any interrupt wakes the CPU */
+	SET_BIT(SMCR, 0);
+}
+
+/* Current time in CPU cycles, if the timer overflowed but the overflow
+ * routine didn't run yet the TOV1 flag is still set, and a small TCNT1 value
+ * means the overflow happened before it was read */
+uint32_t profile_now() {
+	uint16_t overflows;
+	uint16_t tcnt;
+	ATOMIC_BLOCK {
+		overflows = timer1_overflows;
+		tcnt = READ_REG16(TCNT1L);
+		if (READ_BIT(TIFR1, 0) && tcnt < 0x8000) {
+			overflows++;
+		}
+	}
+	return ((uint32_t)overflows << 16) | tcnt;
+}
+
+uint32_t profile_idle_cycles = 0;
+
+/* The idle path of the main loop, sleeps until the next interrupt. The sleep
+ * is always shorter than 65536 cycles since the Timer1 overflow interrupt
+ * wakes the CPU at least that often, so 16-bit timestamps are enough */
+void profile_idle() {
+	__asm__ __volatile__("cli" ::: "memory");
+	uint16_t sleep_tcnt = READ_REG16(TCNT1L);
+	profile_sleeping = 1;
+	/* The instruction after SEI is always executed before any pending
+	 * interrupt, so no interrupt can sneak in between enabling the
+	 * interrupts and going to sleep */
+	__asm__ __volatile__("sei\n\tsleep" ::: "memory");
+	profile_idle_cycles += (uint16_t)(profile_wake_tcnt - sleep_tcnt);
+}
+
+/* Status frame, all values are little endian:
+ *
+ * 0xA5 0x5A         sync bytes
+ * uint8_t  length   number of bytes from seq to the last isr count
+ * uint8_t  seq      window number, a gap means a lost frame
+ * uint32_t total    cycles in the window
+ * uint32_t idle     idle cycles in the window
+ * uint32_t loops    main loop iterations in the window
+ * uint32_t loop_min shortest main loop iteration in cycles
+ * uint32_t loop_max longest main loop iteration in cycles
+ * uint16_t isr[PROFILE_ISR_COUNT] interrupt routine invocations
+ * uint8_t  checksum XOR of the bytes from seq to the last isr count */
+#define PROFILE_FRAME_LENGTH (1 + 4 + 4 + 4 + 4 + 4 + 2 * PROFILE_ISR_COUNT)
+
+uint8_t frame_checksum;
+
+void frame_put(uint8_t byte) {
+	frame_checksum ^= byte;
+	USART_write_byte(byte);
+}
+
+void frame_put16(uint16_t value) {
+	frame_put(value & 0xFF);
+	frame_put(value >> 8);
+}
+
+void frame_put32(uint32_t value) {
+	frame_put16(value & 0xFFFF);
+	frame_put16(value >> 16);
+}
+
+uint8_t profile_seq = 0;
+uint32_t profile_loops = 0;
+uint32_t profile_loop_min = UINT32_MAX;
+uint32_t profile_loop_max = 0;
+
+void profile_report(uint32_t total) {
+	uint16_t isr_counts[PROFILE_ISR_COUNT];
+	ATOMIC_BLOCK {
+		for (uint8_t i = 0; i < PROFILE_ISR_COUNT; i++) {
+			isr_counts[i] = profile_isr_counts[i];
+			profile_isr_counts[i] = 0;
+		}
+	}
+
+	USART_write_byte(0xA5);
+	USART_write_byte(0x5A);
+	USART_write_byte(PROFILE_FRAME_LENGTH);
+	frame_checksum = 0;
+	frame_put(profile_seq++);
+	frame_put32(total);
+	frame_put32(profile_idle_cycles);
+	frame_put32(profile_loops);
+	frame_put32(profile_loop_min);
+	frame_put32(profile_loop_max);
+	for (uint8_t i = 0; i < PROFILE_ISR_COUNT; i++) {
+		frame_put16(isr_counts[i]);
+	}
+	USART_write_byte(frame_checksum);
+
+	profile_idle_cycles = 0;
+	profile_loops = 0;
+	profile_loop_min = UINT32_MAX;
+	profile_loop_max = 0;
+}
+
+// Workload starts here
+
+/* Same fading LED of 5_pwm, an interrupt every timer overflow (62500 per
+ * second) changes the duty cycle every 250 overflows */
+#define MAX_DUTY_CYCLE 250
+
+uint8_t overflow_count = 0;
+int8_t fade_step = 1;
+
+ISR(TIMER0_OVF_VEC) {
+	PROFILE_ISR(PROFILE_ISR_TIMER0_OVF);
+	if (++overflow_count >= MAX_DUTY_CYCLE) {
+		overflow_count = 0;
+		GET_ADDR(OCR0A) += fade_step;
+		if (GET_ADDR(OCR0A) == 0 || GET_ADDR(OCR0A) == MAX_DUTY_CYCLE) {
+			fade_step *= -1;
+		}
+	}
+}
+
+int main(void) {
+	USART_init();
+	profile_init();
+
+	// Fast PWM on OC0A (PD6) without prescaler, same as 5_pwm
+	SET_BIT(DDRD, 6);
+	GET_ADDR(TCCR0A) = (1 << 7) | (1 << 1) | (1 << 0);
+	GET_ADDR(TCCR0B) = (1 << 0);
+	SET_BIT(TIMSK0, 0);
+
+	SET_BIT(SREG, 7);
+
+	uint32_t window_start = profile_now();
+	uint32_t loop_start = window_start;
+	uint8_t iteration = 0;
+
+	while (1) {
+		uint32_t now = profile_now();
+		uint32_t loop_time = now - loop_start;
+		loop_start = now;
+		profile_loops++;
+		if (loop_time < profile_loop_min) {
+			profile_loop_min = loop_time;
+		}
+		if (loop_time > profile_loop_max) {
+			profile_loop_max = loop_time;
+		}
+
+		if (now - window_start >= PROFILE_WINDOW_CYCLES) {
+			profile_report(now - window_start);
+			window_start = now;
+		}
+
+		/* Fake work, every 8th iteration the main loop is busy for a while,
+		 * otherwise there is nothing to do and the CPU goes idle */
+		if ((++iteration & 0x07) == 0) {
+			for (volatile uint16_t i = 2000; i > 0; i--) {
+			}
+		} else {
+			profile_idle();
+		}
+	}
+
+	return 0;
+}
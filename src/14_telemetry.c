@@ -0,0 +1,267 @@
+/* 14_telemetry */
+
+#include "avr_atmega328p.h"
+#include "spsc_queue.h"
+#include "telemetry.h"
+#include <stdint.h>
+
+/* 8_i2c sends every gyro sample as an ASCII line like "x: -1.53, y: 0.38, z:
+ * 12.21", about 40 bytes for 6 bytes of data, at 9600 baud this limits us to
+ * ~24 samples per second. This example sends the same samples in a binary
+ * format described in telemetry.h, each sample takes about 5 bytes and the
+ * USART runs at 250000 baud (an exact UBRR value at 16Mhz, with 0% error),
+ * giving us thousands of samples per second. The host/telemetry_decode.c tool
+ * decodes the stream on the computer. */
+
+// USART with interrupt driven transmission
+
+// #define BAUD 250000
+#define UBRR 3 // ((CPU_CLOCK / 16 / BAUD) - 1)
+
+/* The packet is transmitted in the background by the USART_UDRE_VEC routine
+ * while the next samples are read from the MPU6050 */
+SPSC_QUEUE_DEFINE(byte_queue, uint8_t, 128)
+
+byte_queue_t usart_tx_queue;
+
+void USART_init() {
+	// Setting UBRR value so the BAUD rate is correct
+	GET_ADDR(UBRR0L) = UBRR;
+	GET_ADDR(UBRR0H) = UBRR >> 8;
+
+	// Configure the transmissing data size as 8-bit
+	SET_BIT(UCSR0C, 1);
+	SET_BIT(UCSR0C, 2);
+
+	// Enable the USART transmitter
+	SET_BIT(UCSR0B, 3);
+}
+
+void USART_write_byte(uint8_t byte) {
+	while (!byte_queue_push(&usart_tx_queue, byte)) {
+		// wait for the interrupt routine to free a slot
+	}
+	// UDRIE0 enables the data register empty interrupt
+	SET_BIT(UCSR0B, 5);
+}
+
+ISR(USART_UDRE_VEC) {
+	uint8_t byte;
+	if (byte_queue_pop(&usart_tx_queue, &byte)) {
+		GET_ADDR(UDR0) = byte;
+	} else {
+		// Nothing left to send, disable the interrupt (UDRIE0)
+		UNSET_BIT(UCSR0B, 5);
+	}
+}
+
+// Timestamps
+
+/* Timer1 with a prescaler of 64 ticks every 4us (TELEMETRY_TICK_US), the
+ * overflows extend it to 32-bit */
+volatile uint16_t timer1_overflows = 0;
+
+ISR(TIMER1_OVF_VEC) { timer1_overflows++; }
+
+void timer_init() {
+	// Normal mode, CS10 and CS11 configure the prescaler as 64
+	GET_ADDR(TCCR1A) = 0;
+	GET_ADDR(TCCR1B) = (1 << 0) | (1 << 1);
+	// TOIE1 enables the overflow interrupt
+	SET_BIT(TIMSK1, 0);
+}
+
+uint32_t timer_now() {
+	uint16_t overflows;
+	uint16_t tcnt;
+	ATOMIC_BLOCK {
+		overflows = timer1_overflows;
+		tcnt = READ_REG16(TCNT1L);
+		// Overflow pending but not yet counted by the interrupt routine
+		if (READ_BIT(TIFR1, 0) && tcnt < 0x8000) {
+			overflows++;
+		}
+	}
+	return ((uint32_t)overflows << 16) | tcnt;
+}
+
+void ERROR() {
+	/* Any text sent via USART would be mixed with the binary stream, so the
+	 * built-in LED is the only error indication */
+	SET_BIT(DDRB, 5);
+	while (1) {
+		TOGGLE_BIT(PORTB, 5);
+		for (volatile long int i = 100000; i > 0; i--) {
+		}
+	}
+}
+
+// I2C "driver" starts here, same as 8_i2c
+
+void I2C_wait(uint8_t status) {
+	while (!READ_BIT(TWCR, 7)) {
+		// Wait for TWINT be set as HIGH
+	}
+	if ((GET_ADDR(TWSR) & 0xF8) != status) {
+		ERROR();
+	}
+}
+
+void I2C_start() {
+	// START condition flags TWEN, TWSTA and TWINT
+	GET_ADDR(TWCR) = (1 << 2) | (1 << 5) | (1 << 7);
+	I2C_wait(0x08);
+}
+
+void I2C_restart() {
+	// Repeated START condition flags TWEN, TWSTA and TWINT
+	GET_ADDR(TWCR) = (1 << 2) | (1 << 5) | (1 << 7);
+	I2C_wait(0x10);
+}
+
+void I2C_stop() {
+	// STOP condition flags TWEN, TWSTO and TWINT
+	GET_ADDR(TWCR) = (1 << 2) | (1 << 4) | (1 << 7);
+	while (READ_BIT(TWCR, 4)) {
+		// Wait for TWSTO be set as LOW
+	}
+}
+
+void I2C_master_transmitter(uint8_t addr) {
+	// SLA+W
+	GET_ADDR(TWDR) = (addr << 1);
+	GET_ADDR(TWCR) = (1 << 2) | (1 << 7);
+	I2C_wait(0x18);
+}
+
+void I2C_master_receiver(uint8_t addr) {
+	// SLA+R
+	GET_ADDR(TWDR) = (addr << 1) | 0x01;
+	GET_ADDR(TWCR) = (1 << 2) | (1 << 7);
+	I2C_wait(0x40);
+}
+
+void I2C_write(uint8_t data) {
+	GET_ADDR(TWDR) = data;
+	GET_ADDR(TWCR) = (1 << 2) | (1 << 7);
+	I2C_wait(0x28);
+}
+
+uint8_t I2C_read() {
+	// Receive and return ACK, flags TWEN, TWEA and TWINT
+	GET_ADDR(TWCR) = (1 << 2) | (1 << 6) | (1 << 7);
+	I2C_wait(0x50);
+	return GET_ADDR(TWDR);
+}
+
+uint8_t I2C_read_last() {
+	// Receive and return NOT ACK, flags TWEN and TWINT
+	GET_ADDR(TWCR) = (1 << 2) | (1 << 7);
+	I2C_wait(0x58);
+	return GET_ADDR(TWDR);
+}
+
+#define MPU6050_ADDR 0x68
+#define MPU6050_PWR_MGMT_1 0x6B
+#define MPU6050_GYRO_XOUT_H 0x43
+
+void MPU6050_init() {
+	// 400kHz SCL, TWBR = ((CPU_CLOCK / SCL) - 16) / 2
+	GET_ADDR(TWBR) = 12;
+
+	// Wake up the MPU6050 from its low power mode
+	I2C_start();
+	I2C_master_transmitter(MPU6050_ADDR);
+	I2C_write(MPU6050_PWR_MGMT_1);
+	I2C_write(0x00);
+	I2C_stop();
+}
+
+void MPU6050_read_gyro(int16_t gyro[3]) {
+	I2C_start();
+	I2C_master_transmitter(MPU6050_ADDR);
+	I2C_write(MPU6050_GYRO_XOUT_H);
+	I2C_restart();
+	I2C_master_receiver(MPU6050_ADDR);
+	for (uint8_t i = 0; i < 3; i++) {
+		uint8_t high = I2C_read();
+		uint8_t low = (i == 2) ? I2C_read_last() : I2C_read();
+		gyro[i] = ((uint16_t)high << 8) | low;
+	}
+	I2C_stop();
+}
+
+// Synthetic samples
+
+/* Set to 1 to replace the MPU6050 with a random walk, like the generator of
+ * the host decoder. The firmware then runs without the sensor, otherwise
+ * the first I2C transfer gets no ACK and ends in ERROR() */
+#define TELEMETRY_SYNTHETIC 0
+
+uint16_t synthetic_state = 1;
+
+/* xorshift pseudo random number generator, a few shifts and XORs per number
+ * instead of the 32-bit multiplications of rand() */
+uint16_t synthetic_random() {
+	synthetic_state ^= synthetic_state << 7;
+	synthetic_state ^= synthetic_state >> 9;
+	synthetic_state ^= synthetic_state << 8;
+	return synthetic_state;
+}
+
+void synthetic_read_gyro(int16_t gyro[3]) {
+	static int16_t walk[3] = {0, 0, 0};
+	for (uint8_t i = 0; i < 3; i++) {
+		// Steps between -16 and 15
+		walk[i] += (int16_t)(synthetic_random() & 0x1F) - 16;
+		gyro[i] = walk[i];
+	}
+}
+
+// Telemetry starts here
+
+/* Packets are built in place while sampling, with the functions of
+ * telemetry.h */
+TelemetryPacket packet;
+uint8_t frame[TELEMETRY_MAX_FRAME];
+uint16_t packet_seq = 0;
+
+void packet_send() {
+	uint16_t frame_len = telemetry_packet_finish(&packet, frame);
+	for (uint16_t i = 0; i < frame_len; i++) {
+		USART_write_byte(frame[i]);
+	}
+	// Packet delimiter
+	USART_write_byte(0x00);
+
+	packet_seq++;
+}
+
+int main(void) {
+	USART_init();
+	timer_init();
+	SET_BIT(SREG, 7);
+
+#if !TELEMETRY_SYNTHETIC
+	MPU6050_init();
+#endif
+
+	int16_t gyro[3];
+	while (1) {
+		for (uint8_t i = 0; i < TELEMETRY_SAMPLES_PER_PACKET; i++) {
+			uint32_t timestamp = timer_now();
+#if TELEMETRY_SYNTHETIC
+			synthetic_read_gyro(gyro);
+#else
+			MPU6050_read_gyro(gyro);
+#endif
+			if (i == 0) {
+				telemetry_packet_start(&packet, packet_seq, timestamp);
+			}
+			telemetry_packet_add(&packet, timestamp, gyro);
+		}
+		packet_send();
+	}
+
+	return 0;
+}
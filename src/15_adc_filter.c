@@ -0,0 +1,286 @@
+/* 15_adc_filter */
+
+#include "avr_atmega328p.h"
+#include "spsc_queue.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+/* In 6_adc the ADC runs in free running mode, a new conversion starts as soon
+ * as the last one ends, so the sample rate depends only on the ADC prescaler
+ * (125Khz / 13 cycles = ~9615 samples/s) and in 7_usart the ADC is read
+ * whenever the main loop gets to it. For signal processing the samples must be
+ * taken at an exact rate, any jitter in the sampling time becomes noise.
+ *
+ * The ADC auto trigger can start a conversion on a timer event instead, with
+ * the ADTS flags of ADCSRB set to Timer/Counter1 Compare Match B the hardware
+ * starts every conversion on the exact same clock cycle of the timer period,
+ * no matter what the CPU is doing.
+ *
+ * The samples then go through a filter stage in the ADC interrupt routine:
+ * - a low-pass FIR filter that also decimates, only 1 of every 4 samples is
+ *   calculated. Before dropping samples every frequency above the Nyquist
+ *   frequency of the output (half of its rate) must be removed, otherwise it
+ *   folds back (aliasing) and shows up as a lower frequency in the output
+ * - a biquad IIR low-pass filter at the output rate
+ *
+ * Frequencies above half of the ADC sample rate alias already when sampled,
+ * only an analog filter (a RC filter at the pin) can remove those
+ *
+ * The AVR has no floating point unit, so both filters use fixed point
+ * integers, a coefficient in Q15 format is the integer value / 32768. */
+
+// USART
+
+// #define BAUD 250000
+#define UBRR 3 // ((CPU_CLOCK / 16 / BAUD) - 1)
+
+void USART_init() {
+	// Setting UBRR value so the BAUD rate is correct
+	GET_ADDR(UBRR0L) = UBRR;
+	GET_ADDR(UBRR0H) = UBRR >> 8;
+
+	// Configure the transmissing data size as 8-bit
+	SET_BIT(UCSR0C, 1);
+	SET_BIT(UCSR0C, 2);
+
+	// Enable the USART transmitter
+	SET_BIT(UCSR0B, 3);
+}
+
+void USART_write_byte(uint8_t byte) {
+	while (!READ_BIT(UCSR0A, 5)) {
+		// wait UDREn be HIGH to indicate transmitter register to be empty
+	}
+
+	// write data
+	GET_ADDR(UDR0) = byte;
+}
+
+void USART_print(char *str) {
+	// iterate over the string and transmit byte by byte
+	while (*str) {
+		USART_write_byte(*str++);
+	}
+}
+
+void USART_print_P(const char *str) {
+	uint8_t byte;
+	while ((byte = PGM_READ_BYTE(str++))) {
+		USART_write_byte(byte);
+	}
+}
+
+// Filters
+
+#define SAMPLE_RATE 4000 // Hz
+#define DECIMATION 4     // output rate = 4000 / 4 = 1000Hz
+
+/* 32 taps low-pass FIR, windowed sinc (Hamming window) designed for the
+ * 4000Hz input. The output Nyquist frequency is 500Hz and from there on the
+ * response is below -50dB, anything that folds back is at least 300 times
+ * weaker. The passband is flat up to ~100Hz (-0.4dB) and -3dB at 200Hz:
+ *
+ * 100Hz -0.4dB, 200Hz -3.1dB, 300Hz -10.6dB, 400Hz -26.5dB, 500Hz -50.5dB
+ *
+ * Fewer taps give a wider transition band, 16 taps only reach -22dB at 500Hz
+ * with the same passband.
+ *
+ * The coefficients are in Q15 and sum to 32768 (gain of 1). The filter is
+ * symmetric, so only the first half is stored and each coefficient multiplies
+ * the sum of the two samples that share it, half of the multiplications. Being
+ * a constant table it is kept in the flash */
+#define FIR_TAPS 32 // power of two so the history index wraps with a mask
+
+const int16_t fir_coefs[FIR_TAPS / 2] PROGMEM = {
+	-10,  -36,  -75,  -132, -198, -244, -231, -112,
+	152,  582,  1167, 1861, 2589, 3257, 3768, 4046,
+};
+
+int16_t fir_history[FIR_TAPS];
+uint8_t fir_pos = 0;
+uint8_t decimation_count = 0;
+
+/* Stores the sample in the history and returns 1 with the filtered value in
+ * out once every DECIMATION samples. The sum of products only needs to be
+ * calculated for the outputs we keep, this is what makes decimating cheap */
+uint8_t fir_decimate(int16_t sample, int16_t *out) {
+	fir_history[fir_pos] = sample;
+	fir_pos = (fir_pos + 1) & (FIR_TAPS - 1);
+
+	if (++decimation_count < DECIMATION) {
+		return 0;
+	}
+	decimation_count = 0;
+
+	/* fir_pos is now the oldest sample, the newest is right before it. The
+	 * filter is symmetric, so it doesn't matter which end is which */
+	int32_t acc = 0;
+	uint8_t oldest = fir_pos;
+	uint8_t newest = (fir_pos - 1) & (FIR_TAPS - 1);
+	for (uint8_t i = 0; i < FIR_TAPS / 2; i++) {
+		int16_t coef = PGM_READ_WORD(&fir_coefs[i]);
+		int32_t pair = (int32_t)fir_history[oldest] + fir_history[newest];
+		acc += coef * pair;
+		oldest = (oldest + 1) & (FIR_TAPS - 1);
+		newest = (newest - 1) & (FIR_TAPS - 1);
+	}
+	// Q15 * sample = sample << 15
+	*out = acc >> 15;
+	return 1;
+}
+
+/* Biquad low-pass (Butterworth, cutoff at 50Hz for the 1000Hz output), from
+ * the "Audio EQ Cookbook" formulas, in Q14 since a1 is bigger than 1:
+ *
+ * y = b0 * x + b1 * x1 + b2 * x2 - a1 * y1 - a2 * y2 */
+#define BIQUAD_B0 329
+#define BIQUAD_B1 658
+#define BIQUAD_B2 329
+#define BIQUAD_A1 -25576
+#define BIQUAD_A2 10508
+
+int16_t biquad_x1 = 0, biquad_x2 = 0;
+int16_t biquad_y1 = 0, biquad_y2 = 0;
+
+int16_t biquad(int16_t x) {
+	int32_t acc = (int32_t)BIQUAD_B0 * x;
+	acc += (int32_t)BIQUAD_B1 * biquad_x1;
+	acc += (int32_t)BIQUAD_B2 * biquad_x2;
+	acc -= (int32_t)BIQUAD_A1 * biquad_y1;
+	acc -= (int32_t)BIQUAD_A2 * biquad_y2;
+	int16_t y = acc >> 14;
+
+	biquad_x2 = biquad_x1;
+	biquad_x1 = x;
+	biquad_y2 = biquad_y1;
+	biquad_y1 = y;
+	return y;
+}
+
+// Sampling
+
+/* Timer1 in CTC mode without prescaler, it restarts every
+ * CPU_CLOCK / SAMPLE_RATE cycles, 4000 cycles for 4000Hz */
+#define TIMER_TOP (CPU_CLOCK / SAMPLE_RATE - 1)
+
+SPSC_QUEUE_DEFINE(sample_queue, int16_t, 32)
+
+sample_queue_t filtered_queue;
+
+/* Benchmark, Timer1 counts CPU cycles so reading it before and after the
+ * filters gives us the exact cost of each sample */
+volatile uint32_t bench_cycles = 0;
+volatile uint16_t bench_samples = 0;
+volatile uint16_t bench_max = 0;
+volatile uint8_t dropped = 0;
+
+ISR(ADC_VEC) {
+	/* The auto trigger starts a conversion when the OCF1B flag goes from 0 to
+	 * 1, no interrupt routine clears it for us so it is cleared here, ready
+	 * for the next period. Only OCF1B is written, writing 1 clears a flag */
+	GET_ADDR(TIFR1) = (1 << 2);
+
+	// Read ADCL first then ADCH
+	uint8_t adc_low = GET_ADDR(ADCL);
+	uint16_t adc_read = ((uint16_t)GET_ADDR(ADCH) << 8) | adc_low;
+
+	uint16_t start = READ_REG16(TCNT1L);
+
+	/* Center the 0..1023 reading around 0 and scale it to use more of the
+	 * 16-bit range, keeping more precision through the filters */
+	int16_t sample = ((int16_t)adc_read - 512) * 32;
+	int16_t out;
+	uint8_t ready = fir_decimate(sample, &out);
+	if (ready) {
+		out = biquad(out);
+	}
+
+	uint16_t end = READ_REG16(TCNT1L);
+	// The timer may have restarted at TOP during the filters
+	uint16_t cycles = end >= start ? end - start : end + TIMER_TOP + 1 - start;
+	bench_cycles += cycles;
+	bench_samples++;
+	if (cycles > bench_max) {
+		bench_max = cycles;
+	}
+
+	if (ready && !sample_queue_push(&filtered_queue, out)) {
+		dropped++;
+	}
+}
+
+void sampling_init() {
+	/* Timer1 in CTC mode (WGM12) with TOP = OCR1A, OCR1B is set to the same
+	 * value so the compare match B happens once every period */
+	GET_ADDR(TCCR1A) = 0;
+	WRITE_REG16(OCR1AL, TIMER_TOP);
+	WRITE_REG16(OCR1BL, TIMER_TOP);
+
+	// AVcc as reference (REFS0), reading ADC0 (PC0)
+	SET_BIT(ADMUX, 6);
+	/* Disabling the digital input buffer of ADC0 (ADC0D) reduces the noise and
+	 * power consumption of an analog pin */
+	SET_BIT(DIDR0, 0);
+
+	/* ADTS0 and ADTS2 flags select Timer/Counter1 Compare Match B as the auto
+	 * trigger source */
+	GET_ADDR(ADCSRB) = (1 << 0) | (1 << 2);
+
+	/* ADPS0, ADPS1 and ADPS2 set the prescaler to 128 (125Khz conversion
+	 * clock), a conversion takes ~104us, less than the 250us period.
+	 * ADATE enables the auto trigger, ADIE the interrupt and ADEN the ADC */
+	GET_ADDR(ADCSRA) =
+		(1 << 0) | (1 << 1) | (1 << 2) | (1 << 3) | (1 << 5) | (1 << 7);
+
+	// Start Timer1 (WGM12 and CS10), from now on the sampling is automatic
+	GET_ADDR(TCCR1B) = (1 << 3) | (1 << 0);
+}
+
+int main(void) {
+	USART_init();
+	sampling_init();
+	SET_BIT(SREG, 7);
+
+	char buff[16];
+	uint16_t outputs = 0;
+	while (1) {
+		// Filtered values, one per line, can be plotted by a serial plotter
+		int16_t value;
+		if (sample_queue_pop(&filtered_queue, &value)) {
+			itoa(value, buff, 10);
+			USART_print(buff);
+			USART_print_P(PSTR("\r\n"));
+			outputs++;
+		}
+
+		// Once every second (1000 outputs) print the filter cost
+		if (outputs == SAMPLE_RATE / DECIMATION) {
+			outputs = 0;
+			uint32_t cycles;
+			uint16_t samples, max;
+			uint8_t lost;
+			ATOMIC_BLOCK {
+				cycles = bench_cycles;
+				samples = bench_samples;
+				max = bench_max;
+				lost = dropped;
+				bench_cycles = 0;
+				bench_samples = 0;
+				bench_max = 0;
+				dropped = 0;
+			}
+			USART_print_P(PSTR("# cycles/sample avg: "));
+			utoa(cycles / samples, buff, 10);
+			USART_print(buff);
+			USART_print_P(PSTR(" max: "));
+			utoa(max, buff, 10);
+			USART_print(buff);
+			USART_print_P(PSTR(" dropped: "));
+			utoa(lost, buff, 10);
+			USART_print(buff);
+			USART_print_P(PSTR("\r\n"));
+		}
+	}
+
+	return 0;
+}
@@ -60,6 +60,15 @@ void USART_transmit_string(char *str) {
 	}
 }
 
+/* Same as USART_transmit_string but the string lives in the flash, each byte
+ * is read with the LPM instruction, more on that at "avr_atmega328p.h" */
+void USART_transmit_string_P(const char *str) {
+	uint8_t byte;
+	while ((byte = PGM_READ_BYTE(str++))) {
+		USART_transmit(byte);
+	}
+}
+
 #define BAUD 9600
 
 int main(void) {
@@ -89,7 +98,7 @@ int main(void) {
 	SET_BIT(UCSR0C, 1);
 	SET_BIT(UCSR0C, 2);
 
-	USART_transmit_string("Hello from ATmega328P\r\n");
+	USART_transmit_string_P(PSTR("Hello from ATmega328P\r\n"));
 
 	// ADC initialization
 	ADC_init();
@@ -111,7 +120,7 @@ int main(void) {
 
 			// Send data
 			USART_transmit_string(buff);
-			USART_transmit_string("\r\n");
+			USART_transmit_string_P(PSTR("\r\n"));
 		}
 	}
 
@@ -46,6 +46,30 @@ void USART_println(char *str) {
 	USART_write_byte('\n');
 }
 
+/* Same as USART_println but the string lives in the flash, each byte is read
+ * with the LPM instruction, more on that at "avr_atmega328p.h" */
+void USART_println_P(const char *str) {
+	if (!usart_initialized) {
+		return;
+	}
+	uint8_t byte;
+	while ((byte = PGM_READ_BYTE(str++))) {
+		USART_write_byte(byte);
+	}
+	USART_write_byte('\r');
+	USART_write_byte('\n');
+}
+
+/* Flash aware strcpy, copies a string from the flash into a SRAM buffer so it
+ * can be formatted together with other values. Not named strcpy_P since
+ * avr-libc already has a function with that name */
+char *string_copy_P(char *dst, const char *src) {
+	char *start = dst;
+	while ((*dst++ = PGM_READ_BYTE(src++))) {
+	}
+	return start;
+}
+
 #define OCR0A_MS_64PRESCALER 249 // ((CPU_CLOCK >> 6) / 1000) - 1
 void delay_ms(uint16_t ms) {
 	if (ms == 0) {
@@ -95,7 +119,7 @@ void I2C_start() {
 	/* Read TWSR for status code, if not START condition has been transmitted
 	 * error out */
 	if ((GET_ADDR(TWSR) & 0xF8) != 0x08) {
-		USART_println("Error: start");
+		USART_println_P(PSTR("Error: start"));
 		ERROR();
 	}
 }
@@ -109,7 +133,7 @@ void I2C_restart() {
 	/* Read TWSR for status code, if not repeated START condition has been
 	 * transmitted error out */
 	if ((GET_ADDR(TWSR) & 0xF8) != 0x10) {
-		USART_println("Error: restart");
+		USART_println_P(PSTR("Error: restart"));
 		ERROR();
 	}
 }
@@ -134,8 +158,9 @@ void I2C_master_transmitter(uint8_t addr) {
 	/* Read TWSR for status code, if not SLA+W condition has been
 	 * transmitted and ACK has been received error out */
 	if ((GET_ADDR(TWSR) & 0xF8) != 0x18) {
-		char buf[16] = "addr: ";
-		USART_println("Error: master transmitter");
+		char buf[16];
+		USART_println_P(PSTR("Error: master transmitter"));
+		string_copy_P(buf, PSTR("addr: "));
 		utoa(addr, &buf[6], 16);
 		USART_println(buf);
 		ERROR();
@@ -153,8 +178,9 @@ void I2C_master_receiver(uint8_t addr) {
 	/* Read TWSR for status code, if not SLA+R condition has been
 	 * transmitted and ACK has been received error out */
 	if ((GET_ADDR(TWSR) & 0xF8) != 0x40) {
-		char buf[16] = "addr: ";
-		USART_println("Error: master receiver");
+		char buf[16];
+		USART_println_P(PSTR("Error: master receiver"));
+		string_copy_P(buf, PSTR("addr: "));
 		utoa(addr, &buf[6], 16);
 		USART_println(buf);
 		ERROR();
@@ -172,8 +198,9 @@ void I2C_write(uint8_t data) {
 	/* Read TWSR for status code, if not data byte has been
 	 * transmitted and ACK has been received error out */
 	if ((GET_ADDR(TWSR) & 0xF8) != 0x28) {
-		char buf[16] = "data: ";
-		USART_println("Error: write data");
+		char buf[16];
+		USART_println_P(PSTR("Error: write data"));
+		string_copy_P(buf, PSTR("data: "));
 		utoa(data, &buf[6], 16);
 		USART_println(buf);
 		ERROR();
@@ -189,7 +216,7 @@ uint8_t I2C_read() {
 	/* Read TWSR for status code, if not data byte has been
 	 * received and ACK has been returned error out */
 	if ((GET_ADDR(TWSR) & 0xF8) != 0x50) {
-		USART_println("Error: read data");
+		USART_println_P(PSTR("Error: read data"));
 		ERROR();
 	}
 	return GET_ADDR(TWDR);
@@ -204,7 +231,7 @@ uint8_t I2C_read_last() {
 	/* Read TWSR for status code, if not data byte has been
 	 * received and NOT ACK has been returned error out */
 	if ((GET_ADDR(TWSR) & 0xF8) != 0x58) {
-		USART_println("Error: read last data");
+		USART_println_P(PSTR("Error: read last data"));
 		ERROR();
 	}
 	return GET_ADDR(TWDR);
@@ -212,7 +239,7 @@ uint8_t I2C_read_last() {
 
 int main(void) {
 	USART_init();
-	USART_println("Hello from ATmega328P");
+	USART_println_P(PSTR("Hello from ATmega328P"));
 
 	// MPU6050 I2C address
 	uint8_t mpu6050_addr = 0x68;
@@ -295,13 +322,13 @@ int main(void) {
 		char msg[64] = "\0";
 		char buff[16] = "\0";
 		dtostrf(gyro_x_dgre, 5, 2, buff);
-		strcpy(&msg[strlen(msg)], "x: ");
+		string_copy_P(&msg[strlen(msg)], PSTR("x: "));
 		strcpy(&msg[strlen(msg)], buff);
 		dtostrf(gyro_y_dgre, 5, 2, buff);
-		strcpy(&msg[strlen(msg)], ", y: ");
+		string_copy_P(&msg[strlen(msg)], PSTR(", y: "));
 		strcpy(&msg[strlen(msg)], buff);
 		dtostrf(gyro_z_dgre, 5, 2, buff);
-		strcpy(&msg[strlen(msg)], ", z: ");
+		string_copy_P(&msg[strlen(msg)], PSTR(", z: "));
 		strcpy(&msg[strlen(msg)], buff);
 
 		USART_println(msg);
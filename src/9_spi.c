@@ -0,0 +1,325 @@
+/* 9_spi */
+
+#include "avr_atmega328p.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+// #define BAUD 9600
+#define UBRR 103 // ((CPU_CLOCK / 16 / BAUD) - 1)
+
+void USART_init() {
+	// Setting UBRR value so the BAUD rate is correct
+	GET_ADDR(UBRR0L) = UBRR;
+	GET_ADDR(UBRR0H) = UBRR >> 8;
+
+	// Configure the transmissing data size as 8-bit
+	SET_BIT(UCSR0C, 1);
+	SET_BIT(UCSR0C, 2);
+
+	// Enable the USART transmitter
+	SET_BIT(UCSR0B, 3);
+}
+
+void USART_write_byte(uint8_t byte) {
+	while (!READ_BIT(UCSR0A, 5)) {
+		// wait UDREn be HIGH to indicate transmitter register to be empty
+	}
+
+	// write data
+	GET_ADDR(UDR0) = byte;
+}
+
+void USART_println(char *str) {
+	// iterate over the string and transmit byte by byte
+	while (*str) {
+		USART_write_byte(*str++);
+	}
+	USART_write_byte('\r');
+	USART_write_byte('\n');
+}
+
+/* Same as USART_println but the string lives in the flash, more on that at
+ * "avr_atmega328p.h" */
+void USART_println_P(const char *str) {
+	uint8_t byte;
+	while ((byte = PGM_READ_BYTE(str++))) {
+		USART_write_byte(byte);
+	}
+	USART_write_byte('\r');
+	USART_write_byte('\n');
+}
+
+// SPI "driver" starts here
+
+/* Every device sharing the SPI bus has its own chip-select (CS) pin and may
+ * need a different clock speed or SPI mode, so instead of configuring the
+ * peripheral once we keep a small description of each device and apply it
+ * every time that device is selected.
+ *
+ * port: PORTx address of the CS pin (the DDRx address is always port - 1)
+ * bit: bit number of the CS pin inside PORTx
+ * spcr: value written to SPCR, clock polarity/phase and SPR1:0 clock divider
+ * spsr: value written to SPSR, only SPI2X (bit 0) is writable */
+typedef struct {
+	uint16_t port;
+	uint8_t bit;
+	uint8_t spcr;
+	uint8_t spsr;
+} SPI_device;
+
+/* SPCR flags SPE (bit 6) enables the SPI and MSTR (bit 4) selects master
+ * mode, leaving SPR1:0 as 0 divides the clock by 4 and setting SPI2X in SPSR
+ * doubles it, giving us the fastest SPI clock, fosc/2 = 8Mhz */
+#define SPCR_MASTER ((1 << 6) | (1 << 4))
+#define SPSR_2X (1 << 0)
+
+/* The descriptions never change, so they are kept only in the flash and their
+ * fields are read with PGM_READ_BYTE/PGM_READ_WORD, a SPI_device pointer is
+ * always a flash address */
+
+/* SPI flash chip, using PB2 (SS) as its CS, mode 0 at fosc/2 */
+const SPI_device spi_flash PROGMEM = {PORTB, 2, SPCR_MASTER, SPSR_2X};
+/* SD card, using PD4 as its CS, mode 0 at fosc/4 since long wires to the card
+ * socket do not behave well at 8Mhz */
+const SPI_device spi_sd_card PROGMEM = {PORTD, 4, SPCR_MASTER, 0};
+
+void SPI_init() {
+	/* MOSI (PB3) and SCK (PB5) are driven by the master so they must be set
+	 * as OUTPUT, MISO (PB4) is automatically set as INPUT when the SPI is
+	 * enabled */
+	SET_BIT(DDRB, 3);
+	SET_BIT(DDRB, 5);
+
+	/* When in master mode, if the SS (PB2) pin is an INPUT and it is pulled
+	 * LOW the SPI switches itself to slave mode, so SS must be an OUTPUT even
+	 * if it is not used as a CS */
+	SET_BIT(PORTB, 2);
+	SET_BIT(DDRB, 2);
+}
+
+void SPI_device_init(const SPI_device *dev) {
+	uint16_t port = PGM_READ_WORD(&dev->port);
+	uint8_t bit = PGM_READ_BYTE(&dev->bit);
+	// CS is active LOW, so its idle state is HIGH
+	SET_BIT(port, bit);
+	uint16_t ddr = port - 1;
+	SET_BIT(ddr, bit);
+}
+
+void SPI_select(const SPI_device *dev) {
+	// Apply the device clock and mode configuration before pulling CS LOW
+	GET_ADDR(SPCR) = PGM_READ_BYTE(&dev->spcr);
+	GET_ADDR(SPSR) = PGM_READ_BYTE(&dev->spsr);
+	UNSET_BIT(PGM_READ_WORD(&dev->port), PGM_READ_BYTE(&dev->bit));
+}
+
+void SPI_deselect(const SPI_device *dev) {
+	SET_BIT(PGM_READ_WORD(&dev->port), PGM_READ_BYTE(&dev->bit));
+}
+
+uint8_t SPI_transfer(uint8_t byte) {
+	GET_ADDR(SPDR) = byte;
+	while (!READ_BIT(SPSR, 7)) {
+		// Wait SPIF be set as HIGH indicating the transfer completed
+	}
+	/* Reading SPSR with SPIF set followed by reading SPDR clears SPIF */
+	return GET_ADDR(SPDR);
+}
+
+/* Interrupt driven block transfer state, the main program only starts a
+ * transfer and the SPI_STC_VEC routine feeds the remaining bytes, leaving the
+ * CPU free to fill the next block meanwhile */
+const uint8_t *volatile spi_tx_ptr;
+volatile uint16_t spi_tx_remaining = 0;
+volatile uint8_t spi_busy = 0;
+const SPI_device *volatile spi_device;
+
+/* At fosc/2 a byte is shifted out in only 16 CPU cycles, this is less than
+ * the time the CPU takes to enter and leave an interrupt routine, so for the
+ * fastest clock a tight loop is the best we can do. The next byte is loaded
+ * into a register while the current one is still on the wire, so SPDR is
+ * written as soon as SPIF goes HIGH */
+void SPI_write_block(const SPI_device *dev, const uint8_t *buf, uint16_t len) {
+	if (len == 0) {
+		return;
+	}
+
+	while (spi_busy) {
+		// Wait for any interrupt driven block to finish
+	}
+
+	/* Selecting the device rewrites SPCR, leaving SPIE cleared so no
+	 * interrupt routine steals the SPIF flag from the loop */
+	SPI_select(dev);
+	GET_ADDR(SPDR) = *buf++;
+	while (--len) {
+		uint8_t next = *buf++;
+		while (!READ_BIT(SPSR, 7)) {
+			// Wait SPIF be set as HIGH
+		}
+		GET_ADDR(SPDR) = next;
+	}
+	while (!READ_BIT(SPSR, 7)) {
+		// Wait the last byte to be transmitted
+	}
+	// Dummy read of SPDR to clear SPIF
+	(void)GET_ADDR(SPDR);
+	SPI_deselect(dev);
+}
+
+/* The SPI_STC_VEC interrupt is triggered every time a byte finishes shifting,
+ * executing the routine clears SPIF automatically */
+ISR(SPI_STC_VEC) {
+	if (spi_tx_remaining) {
+		GET_ADDR(SPDR) = *spi_tx_ptr++;
+		spi_tx_remaining--;
+	} else {
+		// Last byte is out, release the device
+		SPI_deselect(spi_device);
+		spi_busy = 0;
+	}
+}
+
+uint8_t SPI_busy() { return spi_busy; }
+
+void SPI_write_block_async(const SPI_device *dev, const uint8_t *buf,
+						   uint16_t len) {
+	if (len == 0) {
+		return;
+	}
+	while (spi_busy) {
+		// Wait for the previous block to finish
+	}
+
+	spi_device = dev;
+	spi_tx_ptr = buf + 1;
+	spi_tx_remaining = len - 1;
+	spi_busy = 1;
+
+	SPI_select(dev);
+	// Setting SPIE enables the SPI transfer complete interrupt
+	SET_BIT(SPCR, 7);
+	// Writing the first byte starts the transfer
+	GET_ADDR(SPDR) = buf[0];
+}
+
+// Benchmark starts here
+
+/* A flash page (and half of an SD card sector) is 256 bytes, two of them are
+ * kept so one can be filled while the other is on the wire */
+#define SPI_BLOCK_SIZE 256
+#define BENCH_BLOCKS 32
+#define BENCH_BYTES ((uint32_t)SPI_BLOCK_SIZE * BENCH_BLOCKS)
+// Timer1 clocked at CPU_CLOCK / 64, each tick is 4us
+#define BENCH_TICKS_PER_SECOND (CPU_CLOCK / 64)
+
+uint8_t sector[2][SPI_BLOCK_SIZE];
+
+/* Stand in for the logging work, fills a block with "samples" */
+uint8_t sample = 0;
+void fill_block(uint8_t *block) {
+	for (uint16_t i = 0; i < SPI_BLOCK_SIZE; i++) {
+		block[i] = sample++;
+	}
+}
+
+void timer_start() {
+	// Clean the timer, high byte must be written first
+	GET_ADDR(TCNT1H) = 0;
+	GET_ADDR(TCNT1L) = 0;
+	// CS10 and CS11 flags configure the prescaler as 64
+	GET_ADDR(TCCR1B) = (1 << 0) | (1 << 1);
+}
+
+uint16_t timer_stop() {
+	// Stop the timer by clearing the clock select flags
+	GET_ADDR(TCCR1B) = 0;
+	// Low byte must be read first, it latches the high byte
+	uint8_t low = GET_ADDR(TCNT1L);
+	return ((uint16_t)GET_ADDR(TCNT1H) << 8) | low;
+}
+
+void print_throughput(const char *label, uint16_t ticks) {
+	char buff[16];
+	// bytes/s = bytes / (ticks / ticks_per_second)
+	uint32_t bytes_per_second = (BENCH_BYTES * BENCH_TICKS_PER_SECOND) / ticks;
+	USART_println_P(label);
+	ultoa(bytes_per_second, buff, 10);
+	USART_println(buff);
+}
+
+/* In master mode SPIF is set by the SPI hardware itself when the byte has
+ * been shifted out, no slave is needed. A simulator may not model that, then
+ * every wait for SPIF would hang forever, so before the benchmark one byte is
+ * sent with a timeout. Returns 0 if SPIF was never set */
+uint8_t SPI_probe() {
+	SPI_select(&spi_flash);
+	GET_ADDR(SPDR) = 0xFF;
+	// A byte takes 16 cycles at fosc/2, 255 loop iterations is plenty
+	uint8_t done = 0;
+	for (uint8_t i = 255; i > 0 && !done; i--) {
+		done = READ_BIT(SPSR, 7);
+	}
+	(void)GET_ADDR(SPDR);
+	SPI_deselect(&spi_flash);
+	return done;
+}
+
+int main(void) {
+	USART_init();
+	USART_println_P(PSTR("Hello from ATmega328P"));
+
+	SPI_init();
+	SPI_device_init(&spi_flash);
+	SPI_device_init(&spi_sd_card);
+
+	if (!SPI_probe()) {
+		USART_println_P(PSTR("SPIF never set, benchmark aborted"));
+		while (1) {
+		}
+	}
+
+	// Enable global interrupts for the asynchronous transfers
+	SET_BIT(SREG, 7);
+
+	/* Single buffered, tight loop: fill a block and then wait for it to be
+	 * sent before filling the next one */
+	timer_start();
+	for (uint8_t i = 0; i < BENCH_BLOCKS; i++) {
+		fill_block(sector[0]);
+		SPI_write_block(&spi_flash, sector[0], SPI_BLOCK_SIZE);
+	}
+	print_throughput(PSTR("tight loop (B/s):"), timer_stop());
+
+	/* Double buffered, interrupt driven: while one block is on the wire the
+	 * CPU fills the other */
+	uint8_t fill = 0;
+	timer_start();
+	for (uint8_t i = 0; i < BENCH_BLOCKS; i++) {
+		fill_block(sector[fill]);
+		SPI_write_block_async(&spi_flash, sector[fill], SPI_BLOCK_SIZE);
+		fill ^= 1;
+	}
+	while (SPI_busy()) {
+		// Wait for the last block
+	}
+	print_throughput(PSTR("double buffered (B/s):"), timer_stop());
+
+	/* Same double buffered transfer on the slower SD card clock, here the
+	 * interrupt routine has time to spare between bytes */
+	timer_start();
+	for (uint8_t i = 0; i < BENCH_BLOCKS; i++) {
+		fill_block(sector[fill]);
+		SPI_write_block_async(&spi_sd_card, sector[fill], SPI_BLOCK_SIZE);
+		fill ^= 1;
+	}
+	while (SPI_busy()) {
+		// Wait for the last block
+	}
+	print_throughput(PSTR("double buffered fosc/4 (B/s):"), timer_stop());
+
+	while (1) {
+	}
+
+	return 0;
+}
@@ -27,6 +27,55 @@
 
 #define READ_BIT(addr, bit) ((GET_ADDR(addr) >> bit) & 0x01)
 
+// FLASH
+
+/* String literals and constant tables are placed by the compiler in the
+ * .data section, the startup code copies them from flash to the SRAM before
+ * main starts, so every "Hello" takes space twice, in the flash (32KB) and in
+ * the much smaller SRAM (2KB). The AVR is a Harvard architecture, the flash
+ * and the SRAM have separated address spaces, so to read data left only in
+ * the flash we need a special instruction, LPM (Load Program Memory), that
+ * reads a byte from the flash address in the Z register.
+ *
+ * PROGMEM places a variable in the flash only:
+ *   const uint8_t table[] PROGMEM = {1, 2, 3};
+ *   uint8_t value = PGM_READ_BYTE(&table[1]);
+ *
+ * PSTR places a string literal in the flash only and returns its address,
+ * it can only be used inside functions:
+ *   USART_println_P(PSTR("Hello"));
+ *
+ * A flash address is not a SRAM address, passing it to a function that
+ * expects a normal string reads garbage, so the functions that receive flash
+ * addresses are suffixed with _P */
+#define PROGMEM __attribute__((__progmem__))
+
+#define PSTR(str)                                                              \
+	(__extension__({                                                           \
+		static const char __pstr[] PROGMEM = (str);                            \
+		&__pstr[0];                                                            \
+	}))
+
+#define PGM_READ_BYTE(addr)                                                    \
+	(__extension__({                                                           \
+		uint16_t __pgm_addr = (uint16_t)(addr);                                \
+		uint8_t __pgm_byte;                                                    \
+		__asm__("lpm %0, Z" : "=r"(__pgm_byte) : "z"(__pgm_addr));             \
+		__pgm_byte;                                                            \
+	}))
+
+// LPM with post increment (Z+) reads the 2 bytes, low byte first
+#define PGM_READ_WORD(addr)                                                    \
+	(__extension__({                                                           \
+		uint16_t __pgm_addr = (uint16_t)(addr);                                \
+		uint16_t __pgm_word;                                                   \
+		__asm__("lpm %A0, Z+\n\t"                                              \
+				"lpm %B0, Z"                                                   \
+				: "=r"(__pgm_word), "=z"(__pgm_addr)                           \
+				: "1"(__pgm_addr));                                            \
+		__pgm_word;                                                            \
+	}))
+
 // INTERRUPTS
 
 /* In order to define a function to be a interrupt handler we must declare it
@@ -43,7 +92,12 @@
 
 #define INT0_VEC __vector_1
 #define INT1_VEC __vector_2
+#define TIMER1_CAPT_VEC __vector_10
+#define TIMER1_OVF_VEC __vector_13
+#define TIMER0_COMPA_VEC __vector_14
 #define TIMER0_OVF_VEC __vector_16
+#define SPI_STC_VEC __vector_17
+#define USART_UDRE_VEC __vector_19
 #define ADC_VEC __vector_21
 
 // REGISTERS
@@ -59,6 +113,7 @@
 #define EIMSK 0x3D
 #define EICRA 0x69
 #define SREG 0x5F
+#define SMCR 0x53
 
 #define TCCR0A 0x44
 #define TCCR0B 0x45
@@ -69,13 +124,23 @@
 
 #define TCCR1A 0x80
 #define TCCR1B 0x81
+#define TCNT1L 0x84
+#define TCNT1H 0x85
+#define ICR1L 0x86
+#define ICR1H 0x87
 #define OCR1AL 0x88
 #define OCR1AH 0x89
+#define OCR1BL 0x8A
+#define OCR1BH 0x8B
+#define TIMSK1 0x6F
+#define TIFR1 0x36
 
 #define ADCL 0x78
 #define ADCH 0x79
 #define ADCSRA 0x7A
+#define ADCSRB 0x7B
 #define ADMUX 0x7C
+#define DIDR0 0x7E
 
 #define UCSR0A 0xC0
 #define UCSR0B 0xC1
@@ -84,6 +149,10 @@
 #define UBRR0H 0xC5
 #define UDR0 0xC6
 
+#define SPCR 0x4C
+#define SPSR 0x4D
+#define SPDR 0x4E
+
 #define TWBR 0xB8
 #define TWSR 0xB9
 #define TWAR 0xBA
@@ -91,4 +160,75 @@
 #define TWCR 0xBC
 #define TWAMR 0xBD
 
+// ATOMIC
+
+/* Enabling or disabling the interrupts with SET_BIT/UNSET_BIT(SREG, 7) works,
+ * but a function that disables them can't simply enable them again at the end
+ * since it could have been called with the interrupts already disabled (from
+ * inside an interrupt routine for example). The ATOMIC_BLOCK saves the SREG,
+ * disables the interrupts with the CLI instruction and restores the SREG when
+ * the block is left, even when leaving with a return:
+ *
+ * ATOMIC_BLOCK {
+ *     value = shared_16bit_value;
+ * }
+ *
+ * Careful with break and continue inside the block, they act on the hidden
+ * for loop of the macro and not on an enclosing loop. A break only leaves the
+ * ATOMIC_BLOCK and the enclosing loop keeps running, to leave the loop set a
+ * flag inside the block and break after it.
+ *
+ * It works by declaring a variable with the cleanup attribute inside a for
+ * loop that runs only once, gcc calls the cleanup function whenever the
+ * variable goes out of scope. The "memory" clobber prevents the compiler from
+ * moving memory accesses outside of the block */
+static inline uint8_t atomic_block_enter(void) {
+	uint8_t sreg = GET_ADDR(SREG);
+	__asm__ __volatile__("cli" ::: "memory");
+	return sreg;
+}
+
+static inline void atomic_block_exit(const uint8_t *sreg) {
+	GET_ADDR(SREG) = *sreg;
+	__asm__ __volatile__("" ::: "memory");
+}
+
+#define __ATOMIC_BLOCK(n)                                                      \
+	for (uint8_t __sreg##n __attribute__((cleanup(atomic_block_exit))) =       \
+			 atomic_block_enter(),                                             \
+			 __todo##n = 1;                                                    \
+		 __todo##n; __todo##n = 0)
+/* __COUNTER__ gives each block its own variable names, so blocks can be
+ * nested without shadowing each other */
+#define _ATOMIC_BLOCK(n) __ATOMIC_BLOCK(n)
+#define ATOMIC_BLOCK _ATOMIC_BLOCK(__COUNTER__)
+
+// 16-BIT REGISTERS
+
+/* The 16-bit registers of Timer1 (TCNT1, OCR1A/B and ICR1) are accessed 8 bits
+ * at a time through a single TEMP register shared by all of them. Writing the
+ * high byte stores it in TEMP and writing the low byte copies both at once,
+ * reading the low byte latches the high byte into TEMP. If an interrupt
+ * routine touches any 16-bit register in between the two accesses TEMP is
+ * overwritten, so the access is done inside an ATOMIC_BLOCK. The address
+ * used is always the low byte (xxxL) */
+#define WRITE_REG16(addr_low, value)                                           \
+	do {                                                                       \
+		uint16_t __write16 = (value);                                          \
+		ATOMIC_BLOCK {                                                         \
+			GET_ADDR(((addr_low) + 1)) = (__write16 >> 8);                     \
+			GET_ADDR(addr_low) = (__write16 & 0xFF);                           \
+		}                                                                      \
+	} while (0)
+
+#define READ_REG16(addr_low)                                                   \
+	({                                                                         \
+		uint16_t __read16;                                                     \
+		ATOMIC_BLOCK {                                                         \
+			uint8_t __low = GET_ADDR(addr_low);                                \
+			__read16 = ((uint16_t)GET_ADDR(((addr_low) + 1)) << 8) | __low;    \
+		}                                                                      \
+		__read16;                                                              \
+	})
+
 #endif /* ifndef __AVR_ATMEGA328P__ */
@@ -0,0 +1,86 @@
+#ifndef __SPSC_QUEUE__
+#define __SPSC_QUEUE__
+
+#include <stdint.h>
+
+/* Single producer single consumer (SPSC) queue, used to pass data between an
+ * interrupt routine and the main program without disabling the interrupts.
+ *
+ * The trick is that each side only writes its own index, the producer only
+ * writes head and the consumer only writes tail. On the AVR an 8-bit store is
+ * a single instruction so the other side never sees a half written index, and
+ * a slot is only published (head incremented) after the data is stored into
+ * it, and the consumer only reads a slot after it has seen the new head, so
+ * it never reads a slot that is still being written. The same goes the other
+ * way for tail, a slot is only freed after its data was read.
+ *
+ * head and tail are free running 8-bit counters, they are never wrapped to the
+ * queue size, the (uint8_t)(head - tail) subtraction gives us the number of
+ * items even after they overflow. Because of this the size must be a power of
+ * two (the slot is found with a mask instead of a slow modulo) and at most 128
+ * (so a full queue, head - tail = size, can be told apart from an empty one).
+ *
+ * Being generic in C means using a macro, SPSC_QUEUE_DEFINE(name, type, size)
+ * declares the name##_t type and its functions:
+ *
+ * SPSC_QUEUE_DEFINE(byte_queue, uint8_t, 32)
+ * byte_queue_t rx_queue;
+ *
+ * byte_queue_push(&rx_queue, byte);  // returns 0 if full
+ * byte_queue_pop(&rx_queue, &byte);  // returns 0 if empty
+ *
+ * The queue variable must start zeroed, global variables already are */
+
+/* Compiler barrier, forbids gcc from moving memory accesses across it. The
+ * slots are not volatile, so the order between a slot access and a (volatile)
+ * index access is only kept by a barrier between them:
+ *
+ * - release: in push the store of the data must not be moved after the store
+ *   of head that publishes it, and in pop the load of the data must not be
+ *   moved after the store of tail that frees the slot for the producer
+ * - acquire: after the full/empty check, the slot access must not be moved
+ *   before the load of the other side's index. In pop the load of a slot can't
+ *   fault, so without the barrier gcc may load it before reading head and
+ *   return the old value of a slot the producer is about to fill */
+#define SPSC_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+#define SPSC_QUEUE_DEFINE(name, type, size)                                    \
+	_Static_assert((size) > 0 && (size) <= 128 &&                              \
+					   ((size) & ((size) - 1)) == 0,                           \
+				   #name " size must be a power of two up to 128");            \
+                                                                               \
+	typedef struct {                                                           \
+		type slots[size];                                                      \
+		volatile uint8_t head;                                                 \
+		volatile uint8_t tail;                                                 \
+	} name##_t;                                                                \
+                                                                               \
+	static inline uint8_t name##_count(const name##_t *q) {                    \
+		return (uint8_t)(q->head - q->tail);                                   \
+	}                                                                          \
+                                                                               \
+	static inline uint8_t name##_push(name##_t *q, type value) {               \
+		uint8_t head = q->head;                                                \
+		if ((uint8_t)(head - q->tail) == (size)) {                             \
+			return 0;                                                          \
+		}                                                                      \
+		SPSC_BARRIER();                                                        \
+		q->slots[head & ((size) - 1)] = value;                                 \
+		SPSC_BARRIER();                                                        \
+		q->head = head + 1;                                                    \
+		return 1;                                                              \
+	}                                                                          \
+                                                                               \
+	static inline uint8_t name##_pop(name##_t *q, type *value) {               \
+		uint8_t tail = q->tail;                                                \
+		if (tail == q->head) {                                                 \
+			return 0;                                                          \
+		}                                                                      \
+		SPSC_BARRIER();                                                        \
+		*value = q->slots[tail & ((size) - 1)];                                \
+		SPSC_BARRIER();                                                        \
+		q->tail = tail + 1;                                                    \
+		return 1;                                                              \
+	}
+
+#endif /* ifndef __SPSC_QUEUE__ */
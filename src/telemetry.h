@@ -0,0 +1,214 @@
+#ifndef __TELEMETRY__
+#define __TELEMETRY__
+
+#include <stdint.h>
+
+/* Binary telemetry protocol, shared by the 14_telemetry firmware and the host
+ * decoder (host/telemetry_decode.c). Both include this file and build the
+ * packets with the same telemetry_packet_* functions, so the self-test of the
+ * decoder (telemetry_decode -g) runs the exact encoder of the firmware.
+ *
+ * Packet payload (before framing):
+ *
+ * uint8_t  type       TELEMETRY_TYPE_GYRO
+ * uint16_t seq        packet number, a gap means lost packets
+ * uint32_t timestamp  time of the first sample in 4us ticks
+ * uint8_t  count      number of samples in the packet
+ * count * sample:
+ *   varint  dt        ticks since the previous sample (0 for the first)
+ *   varint  x, y, z   zig-zag of the difference to the previous sample
+ * uint16_t crc        CRC-16/CCITT-FALSE of everything before it
+ *
+ * All fixed size fields are little endian. The first sample of a packet is
+ * encoded as a difference to 0, so every packet can be decoded on its own and
+ * a lost packet doesn't affect the next ones.
+ *
+ * Gyro values change little between samples, so the differences are small
+ * numbers. Zig-zag encoding maps them to unsigned numbers that are also small
+ * (0, -1, 1, -2, 2... become 0, 1, 2, 3, 4...) and the varint stores 7 bits
+ * per byte, using the 8th bit to mark that more bytes follow, so most samples
+ * take 4 or 5 bytes instead of the ~40 of the ASCII line of 8_i2c.
+ *
+ * Framing uses COBS (Consistent Overhead Byte Stuffing), it removes every 0x00
+ * from the packet with at most 1 extra byte per 254, so 0x00 can be used as
+ * the delimiter between packets. A receiver that starts in the middle of the
+ * stream or loses bytes resynchronizes at the next 0x00. */
+
+#define TELEMETRY_TYPE_GYRO 0x01
+#define TELEMETRY_SAMPLES_PER_PACKET 16
+#define TELEMETRY_TICK_US 4
+
+#define TELEMETRY_HEADER_SIZE 8
+// dt takes up to 5 bytes and each 16-bit axis up to 3 bytes
+#define TELEMETRY_MAX_SAMPLE_SIZE (5 + 3 * 3)
+#define TELEMETRY_MAX_PAYLOAD                                                  \
+	(TELEMETRY_HEADER_SIZE +                                                   \
+	 TELEMETRY_SAMPLES_PER_PACKET * TELEMETRY_MAX_SAMPLE_SIZE + 2)
+// COBS adds 1 byte every 254 bytes, plus the first code byte
+#define TELEMETRY_MAX_FRAME                                                    \
+	(TELEMETRY_MAX_PAYLOAD + TELEMETRY_MAX_PAYLOAD / 254 + 1)
+
+/* The differences are calculated with 16-bit wrap around, the decoder adds
+ * them back with the same wrap around so no extra bits are needed */
+static inline uint16_t telemetry_zigzag(int16_t value) {
+	return ((uint16_t)value << 1) ^ (uint16_t)(value >> 15);
+}
+
+static inline int16_t telemetry_unzigzag(uint16_t value) {
+	return (int16_t)((value >> 1) ^ -(value & 1));
+}
+
+// Returns the number of bytes written to buf
+static inline uint8_t telemetry_put_varint(uint8_t *buf, uint32_t value) {
+	uint8_t len = 0;
+	while (value >= 0x80) {
+		buf[len++] = (value & 0x7F) | 0x80;
+		value >>= 7;
+	}
+	buf[len++] = value;
+	return len;
+}
+
+/* Returns the number of bytes read from buf, or 0 if the varint doesn't end
+ * before end or is longer than 5 bytes */
+static inline uint8_t telemetry_get_varint(const uint8_t *buf,
+										   const uint8_t *end,
+										   uint32_t *value) {
+	uint32_t result = 0;
+	for (uint8_t i = 0; i < 5 && buf + i < end; i++) {
+		result |= (uint32_t)(buf[i] & 0x7F) << (7 * i);
+		if (!(buf[i] & 0x80)) {
+			*value = result;
+			return i + 1;
+		}
+	}
+	return 0;
+}
+
+/* CRC-16/CCITT-FALSE (polynomial 0x1021, initial value 0xFFFF) calculated a
+ * byte at a time without a lookup table */
+#define TELEMETRY_CRC_INIT 0xFFFF
+
+static inline uint16_t telemetry_crc16(uint16_t crc, uint8_t byte) {
+	uint8_t x = (crc >> 8) ^ byte;
+	x ^= x >> 4;
+	return (crc << 8) ^ ((uint16_t)x << 12) ^ ((uint16_t)x << 5) ^ x;
+}
+
+/* Encodes len bytes of src into dst, dst must have space for
+ * len + len / 254 + 1 bytes. The 0x00 delimiter is not added. Returns the
+ * number of bytes written */
+static inline uint16_t telemetry_cobs_encode(const uint8_t *src, uint16_t len,
+											 uint8_t *dst) {
+	uint16_t out = 1;
+	uint16_t code_pos = 0;
+	uint8_t code = 1;
+	for (uint16_t i = 0; i < len; i++) {
+		if (src[i] == 0) {
+			dst[code_pos] = code;
+			code_pos = out++;
+			code = 1;
+		} else {
+			dst[out++] = src[i];
+			if (++code == 0xFF) {
+				dst[code_pos] = code;
+				code_pos = out++;
+				code = 1;
+			}
+		}
+	}
+	dst[code_pos] = code;
+	return out;
+}
+
+/* Decodes len bytes of src (without the 0x00 delimiter) into dst, which must
+ * have space for len bytes. Returns the decoded length or -1 if the frame is
+ * malformed */
+static inline int32_t telemetry_cobs_decode(const uint8_t *src, uint16_t len,
+											uint8_t *dst) {
+	uint16_t in = 0;
+	uint16_t out = 0;
+	while (in < len) {
+		uint8_t code = src[in++];
+		if (code == 0 || in + code - 1 > len) {
+			return -1;
+		}
+		for (uint8_t i = 1; i < code; i++) {
+			dst[out++] = src[in++];
+		}
+		if (code != 0xFF && in < len) {
+			dst[out++] = 0;
+		}
+	}
+	return out;
+}
+
+/* Packet building, used by the firmware and by the generator of the host
+ * decoder so both produce exactly the same bytes:
+ *
+ * TelemetryPacket packet;
+ * telemetry_packet_start(&packet, seq, timestamp);
+ * telemetry_packet_add(&packet, timestamp, sample);  // up to
+ * ...                                                 // SAMPLES_PER_PACKET
+ * uint16_t len = telemetry_packet_finish(&packet, frame);
+ *
+ * The 0x00 delimiter is not part of the frame, it is sent after it */
+typedef struct {
+	uint8_t payload[TELEMETRY_MAX_PAYLOAD];
+	uint8_t len;
+	uint8_t count;
+	uint32_t last_time;
+	int16_t last[3];
+} TelemetryPacket;
+
+/* Fills the fixed header, timestamp must be the time of the first sample */
+static inline void telemetry_packet_start(TelemetryPacket *packet,
+										  uint16_t seq, uint32_t timestamp) {
+	packet->payload[0] = TELEMETRY_TYPE_GYRO;
+	packet->payload[1] = seq & 0xFF;
+	packet->payload[2] = seq >> 8;
+	for (uint8_t i = 0; i < 4; i++) {
+		packet->payload[3 + i] = timestamp >> (8 * i);
+	}
+	packet->len = TELEMETRY_HEADER_SIZE;
+	packet->count = 0;
+	packet->last_time = timestamp;
+	// The first sample is a difference to 0
+	for (uint8_t i = 0; i < 3; i++) {
+		packet->last[i] = 0;
+	}
+}
+
+static inline void telemetry_packet_add(TelemetryPacket *packet,
+										uint32_t timestamp,
+										const int16_t sample[3]) {
+	packet->len += telemetry_put_varint(&packet->payload[packet->len],
+										timestamp - packet->last_time);
+	packet->last_time = timestamp;
+	for (uint8_t i = 0; i < 3; i++) {
+		int16_t delta = (uint16_t)(sample[i] - packet->last[i]);
+		packet->len += telemetry_put_varint(&packet->payload[packet->len],
+											telemetry_zigzag(delta));
+		packet->last[i] = sample[i];
+	}
+	packet->count++;
+}
+
+/* Writes the sample count and the CRC and encodes the packet into frame,
+ * which must have space for TELEMETRY_MAX_FRAME bytes. Returns the number of
+ * bytes written */
+static inline uint16_t telemetry_packet_finish(TelemetryPacket *packet,
+											   uint8_t *frame) {
+	packet->payload[7] = packet->count;
+
+	uint16_t crc = TELEMETRY_CRC_INIT;
+	for (uint8_t i = 0; i < packet->len; i++) {
+		crc = telemetry_crc16(crc, packet->payload[i]);
+	}
+	packet->payload[packet->len++] = crc & 0xFF;
+	packet->payload[packet->len++] = crc >> 8;
+
+	return telemetry_cobs_encode(packet->payload, packet->len, frame);
+}
+
+#endif /* ifndef __TELEMETRY__ */